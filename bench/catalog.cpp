@@ -0,0 +1,228 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+// Measure the time to open an SCM file and to look up pages in its catalog.
+//
+// For each catalog size, a BigTIFF is written holding a single page directory
+// and a catalog of sparse, sorted page indices. It is written twice: once with
+// the catalog aligned, so that scm_file references it in place within the file
+// mapping, and once misaligned, so that scm_file copies it and builds its search
+// tree. Random lookups, about half of them for absent pages, go through
+// get_page_status and are checked against the known catalog. Lookups repeat
+// until the search tree has had ample time to complete, and the best pass is
+// reported.
+//
+//     catalog [pages ...]
+//
+// The defaults are catalogs of 1, 10, and 100 million pages. The largest needs
+// about 1.6 GB of disk and several times that in memory when copied.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+#include <SDL.h>
+#include <tiffio.h>
+
+#include "../scm-file.hpp"
+
+//------------------------------------------------------------------------------
+
+static double now()
+{
+    return double(SDL_GetPerformanceCounter())
+         / double(SDL_GetPerformanceFrequency());
+}
+
+// Return a 64-bit pseudo-random number.
+
+static uint64 next()
+{
+    static uint64 x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >>  7;
+    x ^= x << 17;
+
+    return x;
+}
+
+// Append a BigTIFF directory entry with an inline value.
+
+static void entry(std::vector<char>& d, uint16 tag, uint16 type,
+                                        uint64 count, uint64 value)
+{
+    const size_t o = d.size();
+
+    d.resize(o + 20, 0);
+
+    const uint16 s = uint16(value);
+    const uint32 l = uint32(value);
+
+    memcpy(&d[o +  0], &tag,   2);
+    memcpy(&d[o +  2], &type,  2);
+    memcpy(&d[o +  4], &count, 8);
+
+    switch (type)
+    {
+    case  3: memcpy(&d[o + 12], &s,     2); break;
+    case  4: memcpy(&d[o + 12], &l,     4); break;
+    default: memcpy(&d[o + 12], &value, 8); break;
+    }
+}
+
+// Write a BigTIFF in host byte order with one 1x1 page directory, which also
+// serves as every page of the catalog xv. Skew the catalog arrays by one byte
+// to misalign them. Return false on failure.
+
+static bool write(const char *name, const std::vector<uint64>& xv, bool skew)
+{
+    const uint16 one    = 1;
+    const bool   little = (*((const char *) &one) == 1);
+    const uint64 n      = xv.size();
+    const uint64 o      = 16;
+    const uint64 x      = 256 + (skew ? 1 : 0);
+    const uint64 v      = x + 8 * n;
+
+    std::vector<char> d;
+
+    d.push_back(little ? 'I' : 'M');
+    d.push_back(little ? 'I' : 'M');
+
+    const uint16 h[3] = { 43, 8, 0 };
+
+    d.insert(d.end(), (const char *) h, (const char *) (h + 3));
+    d.insert(d.end(), (const char *) &o, (const char *) (&o + 1));
+
+    const uint64 k = 11;
+
+    d.insert(d.end(), (const char *) &k, (const char *) (&k + 1));
+
+    entry(d, TIFFTAG_IMAGEWIDTH,      4,  1, 1);
+    entry(d, TIFFTAG_IMAGELENGTH,     4,  1, 1);
+    entry(d, TIFFTAG_BITSPERSAMPLE,   3,  1, 8);
+    entry(d, TIFFTAG_COMPRESSION,     3,  1, COMPRESSION_NONE);
+    entry(d, TIFFTAG_PHOTOMETRIC,     3,  1, PHOTOMETRIC_MINISBLACK);
+    entry(d, TIFFTAG_STRIPOFFSETS,    16, 1, 0);
+    entry(d, TIFFTAG_SAMPLESPERPIXEL, 3,  1, 1);
+    entry(d, TIFFTAG_ROWSPERSTRIP,    4,  1, 1);
+    entry(d, TIFFTAG_STRIPBYTECOUNTS, 16, 1, 1);
+    entry(d, 0xFFB1,                  16, n, x);
+    entry(d, 0xFFB2,                  16, n, v);
+
+    d.resize(size_t(x), 0);
+
+    bool ok = false;
+
+    if (FILE *fp = fopen(name, "wb"))
+    {
+        ok = (fwrite(&d[0], 1, d.size(), fp) == d.size())
+          && (fwrite(&xv[0], 8, size_t(n), fp) == size_t(n));
+
+        // Every page is the directory above.
+
+        std::vector<uint64> ov(1 << 16, o);
+
+        for (uint64 j = 0; ok && j < n; j += ov.size())
+        {
+            const size_t m = size_t(std::min(uint64(ov.size()), n - j));
+            ok = (fwrite(&ov[0], 8, m, fp) == m);
+        }
+        ok = (fclose(fp) == 0) && ok;
+    }
+    return ok;
+}
+
+// Open the file and look up random pages, reporting the open time and the best
+// lookup time of several passes. Check each answer against the expected one.
+
+static void run(const char *name, const char *mode,
+                const std::vector<uint64>& q,
+                const std::vector<bool>&   e, uint64 n)
+{
+    const double t0 = now();
+
+    scm_file *f = new scm_file(name, name);
+
+    const double t1 = now();
+
+    double best  = 1e9;
+    size_t wrong = 0;
+
+    do
+    {
+        const double t2 = now();
+
+        for (size_t k = 0; k < q.size(); ++k)
+            if (f->get_page_status(q[k]) != e[k])
+                wrong++;
+
+        best = std::min(best, now() - t2);
+    }
+    while (now() - t1 < std::max(1.0, 4 * (t1 - t0)));
+
+    printf("%11lu pages %-7s open %8.3f ms  lookup %7.1f ns  (%lu wrong)\n",
+           (unsigned long) n, mode, 1e3 * (t1 - t0),
+           1e9 * best / q.size(), (unsigned long) wrong);
+
+    delete f;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    std::vector<uint64> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(strtoull(argv[i], 0, 10));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(  1000000);
+        sizes.push_back( 10000000);
+        sizes.push_back(100000000);
+    }
+
+    const char *name = "scm-bench-catalog.tif";
+
+    TIFFSetWarningHandler(0);
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        // Generate a sparse sorted catalog and a set of queries spanning it.
+
+        std::vector<uint64> xv(size_t(sizes[s]));
+        std::vector<uint64> q(1000000);
+
+        uint64 i = 0;
+
+        for (size_t j = 0; j < xv.size(); ++j)
+            xv[j] = (i += 1 + next() % 3);
+
+        std::vector<bool>   e(q.size());
+
+        for (size_t k = 0; k < q.size(); ++k)
+        {
+            q[k] = next() % (i + 1);
+            e[k] = std::binary_search(xv.begin(), xv.end(), q[k]);
+        }
+
+        if (write(name, xv, false)) run(name, "mapped", q, e, xv.size());
+        if (write(name, xv, true))  run(name, "copied", q, e, xv.size());
+
+        remove(name);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+// Measure the rate at which the loader decodes pages under each TIFF codec.
+//
+// Synthetic SCM pages are written to a temporary TIFF once per codec, using
+// the strip layout of SCM files, and then read back through scm_load_page as
+// the loader threads do. For each codec configured in libtiff the program
+// reports the compressed size relative to the raw pages and the decode rate
+// in pages per second.
+//
+//     codec [pages [n [c [b [rows]]]]]
+//
+// The defaults are 256 pages of 256x256 8-bit RGB with 32 rows per strip.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include <SDL.h>
+#include <tiffio.h>
+
+#include "../scm-file.hpp"
+#include "../scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+struct codec
+{
+    uint16      z;
+    const char *name;
+};
+
+static const codec codecs[] =
+{
+    { COMPRESSION_NONE,          "none"     },
+    { COMPRESSION_PACKBITS,      "packbits" },
+    { COMPRESSION_LZW,           "lzw"      },
+    { COMPRESSION_ADOBE_DEFLATE, "deflate"  },
+#ifdef COMPRESSION_ZSTD
+    { COMPRESSION_ZSTD,          "zstd"     },
+#endif
+#ifdef COMPRESSION_LZMA
+    { COMPRESSION_LZMA,          "lzma"     },
+#endif
+};
+
+static double now()
+{
+    return double(SDL_GetPerformanceCounter())
+         / double(SDL_GetPerformanceFrequency());
+}
+
+// Fill a page with smooth terrain-like values plus a little noise, so that
+// each codec sees data resembling a real height or color map.
+
+static void fill(void *p, int k, int w, int c, int b)
+{
+    for     (int y = 0; y < w; ++y)
+        for (int x = 0; x < w; ++x)
+            for (int i = 0; i < c; ++i)
+            {
+                const double s = 0.5 + 0.25 * sin((x + 37 * k) * 0.031 + i)
+                                     + 0.15 * sin((y + 11 * k) * 0.047 - i)
+                                     + 0.05 * sin((x - y) * 0.19)
+                                     + 0.02 * (rand() / double(RAND_MAX));
+
+                const size_t j = (size_t(y) * w + x) * c + i;
+
+                switch (b)
+                {
+                case  8: ((uint8  *) p)[j] = uint8 (s *   255.0); break;
+                case 16: ((uint16 *) p)[j] = uint16(s * 65535.0); break;
+                case 32: ((float  *) p)[j] = float (s);           break;
+                }
+            }
+}
+
+// Write the pages to a BigTIFF as SCM does, one directory per page, and note
+// the offset of each directory. Return the file size, or zero on failure.
+
+static uint64 write(const char *name, uint16 z, const std::vector<void *>& v,
+                    int w, int c, int b, int rows, std::vector<uint64>& o)
+{
+    if (TIFF *T = TIFFOpen(name, "w8"))
+    {
+        for (size_t k = 0; k < v.size(); ++k)
+        {
+            TIFFSetField(T, TIFFTAG_IMAGEWIDTH,      w);
+            TIFFSetField(T, TIFFTAG_IMAGELENGTH,     w);
+            TIFFSetField(T, TIFFTAG_BITSPERSAMPLE,   b);
+            TIFFSetField(T, TIFFTAG_SAMPLESPERPIXEL, c);
+            TIFFSetField(T, TIFFTAG_ROWSPERSTRIP,    rows);
+            TIFFSetField(T, TIFFTAG_COMPRESSION,     z);
+            TIFFSetField(T, TIFFTAG_PLANARCONFIG,    PLANARCONFIG_CONTIG);
+            TIFFSetField(T, TIFFTAG_PHOTOMETRIC,     c == 3 ? PHOTOMETRIC_RGB
+                                                   : PHOTOMETRIC_MINISBLACK);
+            if (b == 32)
+                TIFFSetField(T, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+            if (z != COMPRESSION_NONE && z != COMPRESSION_PACKBITS)
+                TIFFSetField(T, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+
+            const tsize_t s = tsize_t(w) * c * b / 8;
+
+            for (int r = 0; r < w; r += rows)
+                TIFFWriteEncodedStrip(T, r / rows, (uint8 *) v[k] + r * s,
+                                      std::min(rows, w - r) * s);
+
+            TIFFWriteDirectory(T);
+        }
+        TIFFClose(T);
+    }
+
+    uint64 n = 0;
+
+    if (TIFF *T = TIFFOpen(name, "r"))
+    {
+        o.clear();
+        do
+            o.push_back(uint64(TIFFCurrentDirOffset(T)));
+        while (TIFFReadDirectory(T));
+
+        TIFFClose(T);
+    }
+    if (FILE *fp = fopen(name, "rb"))
+    {
+        if (fseek(fp, 0, SEEK_END) == 0)
+            n = uint64(ftell(fp));
+        fclose(fp);
+    }
+    return (o.size() == v.size()) ? n : 0;
+}
+
+// Decode every page once per pass, keeping the best of several passes, and
+// return pages per second. Set ok false if any page fails to decode or differs
+// from its source.
+
+static double read(const char *name, const std::vector<void *>& v,
+                   const std::vector<uint64>& o, int w, int c, int b, bool& ok)
+{
+    const size_t n = size_t(w) * w * c * b / 8;
+
+    std::vector<char> p(n);
+
+    double best = 0.0;
+
+    ok = true;
+
+    if (TIFF *T = TIFFOpen(name, "r"))
+    {
+        for (int pass = 0; pass < 3; ++pass)
+        {
+            const double t0 = now();
+
+            for (size_t k = 0; k < o.size(); ++k)
+                if (!scm_load_page(name, (long long) k, T, o[k], w, w, c, b, &p[0])
+                    || memcmp(&p[0], v[k], n) != 0)
+                    ok = false;
+
+            best = std::max(best, o.size() / (now() - t0));
+        }
+        TIFFClose(T);
+    }
+    else ok = false;
+
+    return best;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    const int pages = (argc > 1) ? atoi(argv[1]) : 256;
+    const int n     = (argc > 2) ? atoi(argv[2]) : 256;
+    const int c     = (argc > 3) ? atoi(argv[3]) :   3;
+    const int b     = (argc > 4) ? atoi(argv[4]) :   8;
+    const int rows  = (argc > 5) ? atoi(argv[5]) :  32;
+    const int w     = n + 2;
+
+    const char  *name = "scm-bench-codec.tif";
+    const size_t size = size_t(w) * w * c * b / 8;
+
+    TIFFSetWarningHandler(0);
+
+    std::vector<void *> v(pages);
+
+    for (int k = 0; k < pages; ++k)
+        if ((v[k] = malloc(size)))
+            fill(v[k], k, w, c, b);
+        else
+            return EXIT_FAILURE;
+
+    printf("%d pages of %dx%d, %d channels of %d bits, %d rows per strip\n",
+           pages, w, w, c, b, rows);
+    printf("%-10s %8s %12s %12s\n", "codec", "ratio", "pages/s", "MB/s");
+
+    for (size_t i = 0; i < sizeof (codecs) / sizeof (codec); ++i)
+    {
+        std::vector<uint64> o;
+
+        if (!TIFFIsCODECConfigured(codecs[i].z))
+            printf("%-10s %8s\n", codecs[i].name, "n/a");
+
+        else if (uint64 z = write(name, codecs[i].z, v, w, c, b, rows, o))
+        {
+            bool         ok;
+            const double r = read(name, v, o, w, c, b, ok);
+
+            printf("%-10s %8.3f %12.1f %12.1f%s\n", codecs[i].name,
+                   double(z) / (double(size) * pages), r, r * size / 1e6,
+                   ok ? "" : "  (decode failed)");
+        }
+        else printf("%-10s %8s\n", codecs[i].name, "failed");
+    }
+    remove(name);
+
+    for (int k = 0; k < pages; ++k)
+        free(v[k]);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,324 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+// Stress and measure scm_queue under the traffic of the render and loader
+// threads, alongside the mutex-guarded std::set that it replaced.
+//
+// Three tests are run on each queue. The first fills and drains the queue from
+// one thread using the non-blocking calls, as the render thread does. The
+// second runs producers and consumers at once, alternating the blocking and
+// non-blocking calls, and checks that every item is removed exactly once. The
+// third times the render thread's try_insert while loaders drain the queue.
+//
+//     queue [producers [consumers [items]]]
+//
+// The defaults are 4 producers and 4 consumers of 200000 items each.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <set>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include "../scm-queue.hpp"
+#include "../scm-task.hpp"
+
+//------------------------------------------------------------------------------
+
+// The queue as it was: a std::set guarded by a mutex and two semaphores.
+
+template <typename T> class set_queue
+{
+public:
+
+    set_queue(int n)
+    {
+        full_slots = SDL_CreateSemaphore(0);
+        free_slots = SDL_CreateSemaphore(n);
+        data_mutex = SDL_CreateMutex();
+    }
+   ~set_queue()
+    {
+        SDL_DestroyMutex    (data_mutex);
+        SDL_DestroySemaphore(free_slots);
+        SDL_DestroySemaphore(full_slots);
+    }
+
+    bool try_insert(T& d)
+    {
+        if (SDL_SemTryWait(free_slots) == 0)
+        {
+            push(d);
+            SDL_SemPost(full_slots);
+            return true;
+        }
+        return false;
+    }
+    bool try_remove(T& d)
+    {
+        if (SDL_SemTryWait(full_slots) == 0)
+        {
+            pop(d);
+            SDL_SemPost(free_slots);
+            return true;
+        }
+        return false;
+    }
+
+    void insert(T d)
+    {
+        SDL_SemWait(free_slots);
+        push(d);
+        SDL_SemPost(full_slots);
+    }
+    T remove()
+    {
+        T d;
+        SDL_SemWait(full_slots);
+        pop(d);
+        SDL_SemPost(free_slots);
+        return d;
+    }
+
+private:
+
+    void push(const T& d)
+    {
+        SDL_LockMutex(data_mutex);
+        S.insert(d);
+        SDL_UnlockMutex(data_mutex);
+    }
+    void pop(T& d)
+    {
+        SDL_LockMutex(data_mutex);
+        d = *S.begin();
+        S.erase(S.begin());
+        SDL_UnlockMutex(data_mutex);
+    }
+
+    SDL_sem    *full_slots;
+    SDL_sem    *free_slots;
+    SDL_mutex  *data_mutex;
+    std::set<T> S;
+};
+
+//------------------------------------------------------------------------------
+
+static int producers = 4;
+static int consumers = 4;
+static int items     = 200000;
+
+static const int slots = 32;
+
+static double now()
+{
+    return double(SDL_GetPerformanceCounter())
+         / double(SDL_GetPerformanceFrequency());
+}
+
+template <typename Q> struct worker
+{
+    Q                *q;
+    int               id;
+    std::vector<int> *seen;
+};
+
+// Insert items numbered by producer and sequence, alternating the blocking
+// call with retries of the non-blocking one.
+
+template <typename Q> int produce(void *data)
+{
+    worker<Q> *w = (worker<Q> *) data;
+
+    for (int k = 0; k < items; ++k)
+    {
+        scm_task t(w->id, k);
+
+        if (k & 1)
+            w->q->insert(t);
+        else
+            while (!w->q->try_insert(t))
+                SDL_Delay(0);
+    }
+    return 0;
+}
+
+// Remove this consumer's share of the items, counting each one seen.
+
+template <typename Q> int consume(void *data)
+{
+    worker<Q> *w = (worker<Q> *) data;
+
+    const int n = items * producers / consumers
+                + (w->id < items * producers % consumers ? 1 : 0);
+
+    for (int k = 0; k < n; ++k)
+    {
+        scm_task t;
+
+        if (k & 1)
+            t = w->q->remove();
+        else
+            while (!w->q->try_remove(t))
+                SDL_Delay(0);
+
+        (*w->seen)[size_t(t.f) * items + size_t(t.i)]++;
+    }
+    return 0;
+}
+
+// Remove items until one with a negative file index arrives.
+
+template <typename Q> int drain(void *data)
+{
+    worker<Q> *w = (worker<Q> *) data;
+
+    while (w->q->remove().f >= 0)
+        ;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// Fill and drain the queue from a single thread with the non-blocking calls.
+
+template <typename Q> void single(const char *name)
+{
+    Q q(slots);
+
+    const int    R  = 100000;
+    const double t0 = now();
+
+    for (int r = 0; r < R; ++r)
+    {
+        scm_task t;
+
+        for (int k = 0; k < slots; ++k)
+        {
+            scm_task u(k, r);
+            q.try_insert(u);
+        }
+        for (int k = 0; k < slots; ++k)
+            q.try_remove(t);
+    }
+    printf("%-10s single thread:  %8.2f M insert-remove pairs/s\n",
+           name, double(R) * slots / (now() - t0) / 1e6);
+}
+
+// Run producers and consumers at once and check that each item arrives once.
+
+template <typename Q> bool stress(const char *name)
+{
+    Q q(slots);
+
+    std::vector<std::vector<int> > seen(consumers,
+                                        std::vector<int>(size_t(producers) * items));
+    std::vector<worker<Q> >  w(producers + consumers);
+    std::vector<SDL_Thread *> v;
+
+    const double t0 = now();
+
+    for (int i = 0; i < consumers; ++i)
+    {
+        w[i].q    = &q;
+        w[i].id   = i;
+        w[i].seen = &seen[i];
+        v.push_back(SDL_CreateThread(consume<Q>, "consumer", &w[i]));
+    }
+    for (int i = 0; i < producers; ++i)
+    {
+        w[consumers + i].q  = &q;
+        w[consumers + i].id = i;
+        v.push_back(SDL_CreateThread(produce<Q>, "producer", &w[consumers + i]));
+    }
+    for (size_t i = 0; i < v.size(); ++i)
+        SDL_WaitThread(v[i], 0);
+
+    const double dt = now() - t0;
+
+    size_t bad = 0;
+
+    for (size_t j = 0; j < size_t(producers) * items; ++j)
+    {
+        int n = 0;
+
+        for (int i = 0; i < consumers; ++i)
+            n += seen[i][j];
+
+        if (n != 1) bad++;
+    }
+    printf("%-10s %d producers, %d consumers: %8.2f M items/s, %lu lost or repeated\n",
+           name, producers, consumers, double(producers) * items / dt / 1e6,
+           (unsigned long) bad);
+
+    return (bad == 0);
+}
+
+// Time the render thread's try_insert while loader threads drain the queue.
+
+template <typename Q> void latency(const char *name)
+{
+    Q q(slots);
+
+    std::vector<worker<Q> >   w(consumers);
+    std::vector<SDL_Thread *> v;
+    std::vector<double>       t;
+
+    for (int i = 0; i < consumers; ++i)
+    {
+        w[i].q = &q;
+        v.push_back(SDL_CreateThread(drain<Q>, "drain", &w[i]));
+    }
+    for (int k = 0; k < items; ++k)
+    {
+        scm_task u(0, k);
+
+        const double t0 = now();
+        q.try_insert(u);
+        t.push_back(now() - t0);
+    }
+    for (int i = 0; i < consumers; ++i)
+        q.insert(scm_task(-1, 0));
+    for (size_t i = 0; i < v.size(); ++i)
+        SDL_WaitThread(v[i], 0);
+
+    std::sort(t.begin(), t.end());
+
+    const size_t n = t.size();
+
+    printf("%-10s try_insert with %d loaders: median %.2f us, "
+           "99%% %.2f us, 99.9%% %.2f us\n", name, consumers,
+           1e6 * t[n / 2], 1e6 * t[n * 99 / 100], 1e6 * t[n * 999 / 1000]);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) producers = std::max(1, atoi(argv[1]));
+    if (argc > 2) consumers = std::max(1, atoi(argv[2]));
+    if (argc > 3) items     = std::max(1, atoi(argv[3]));
+
+    bool ok = true;
+
+    single <set_queue<scm_task> >("set+mutex");
+    single <scm_queue<scm_task> >("scm_queue");
+    ok &= stress<set_queue<scm_task> >("set+mutex");
+    ok &= stress<scm_queue<scm_task> >("scm_queue");
+    latency<set_queue<scm_task> >("set+mutex");
+    latency<scm_queue<scm_task> >("scm_queue");
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,200 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+// Measure scm_set under the traffic of a cache atlas, alongside the std::map
+// that it replaced.
+//
+// For each number of slots, a sequence of frames is generated. Each frame
+// touches, in random order, the pages of a window that drifts across a larger
+// range of page indices. A touch searches the set and, on a miss, inserts the
+// page, ejecting one first if the set is full, as the cache does in get_slot.
+// The same sequence is replayed on each set and the mean time per touch and the
+// hit rate are reported.
+//
+//     set [slots ...]
+//
+// The defaults are 256, 1024, 4096, and 16384 slots.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <map>
+
+#include <SDL.h>
+
+#include "../scm-set.hpp"
+
+//------------------------------------------------------------------------------
+
+// The set as it was: a std::map from page to time of last use.
+
+class map_set
+{
+public:
+
+    scm_page search(scm_page page, int t)
+    {
+        std::map<scm_page, int>::iterator i = m.find(page);
+
+        if (i != m.end())
+        {
+            scm_page p = i->first;
+
+            remove(p);
+            insert(p, t);
+            return(p);
+        }
+        return scm_page();
+    }
+
+    void insert(scm_page page, int t) { m[page] = t; }
+    void remove(scm_page page)        { m.erase(page); }
+
+    scm_page eject(int t, long long i, bool)
+    {
+        std::map<scm_page, int>::iterator a = m.end();
+        std::map<scm_page, int>::iterator l = m.end();
+        std::map<scm_page, int>::iterator e;
+
+        for (e = m.begin(); e != m.end(); ++e)
+        {
+            if (a == m.end() || e->second < a->second)
+                a = e;
+            l = e;
+        }
+        if (a != m.end() && a->second < t - 2)
+        {
+            scm_page page = a->first;
+            m.erase(a);
+            return page;
+        }
+        if (l != m.end() && i < l->first.i)
+        {
+            scm_page page = l->first;
+            m.erase(l);
+            return page;
+        }
+        return scm_page();
+    }
+
+    size_t size() const { return m.size(); }
+
+private:
+
+    std::map<scm_page, int> m;
+};
+
+//------------------------------------------------------------------------------
+
+static double now()
+{
+    return double(SDL_GetPerformanceCounter())
+         / double(SDL_GetPerformanceFrequency());
+}
+
+// Generate frames of page touches for a set of n slots. Each frame touches
+// three quarters of n pages from a window that advances by n / 16 pages per
+// frame through a range of 4 n pages. Note the start of each frame in f.
+
+static void frames(int n, std::vector<long long>& q, std::vector<size_t>& f)
+{
+    const int range  = 4 * n;
+    const int window = 3 * n / 4;
+    const int total  = 250000;
+
+    std::vector<long long> w(window);
+
+    q.clear();
+    f.clear();
+
+    for (int s = 0; int(q.size()) < total; s += std::max(1, n / 16))
+    {
+        for (int k = 0; k < window; ++k)
+            w[k] = 6 + (s + k) % range;
+
+        std::random_shuffle(w.begin(), w.end());
+
+        f.push_back(q.size());
+        q.insert(q.end(), w.begin(), w.end());
+    }
+    f.push_back(q.size());
+}
+
+// Replay the frames on a set of n slots, keeping the best of several passes,
+// and print the time per touch and the hit rate.
+
+template <typename S> void run(const char *name, int n,
+                               const std::vector<long long>& q,
+                               const std::vector<size_t>&    f)
+{
+    double best = 1e9;
+    size_t hits = 0;
+
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        S s;
+
+        hits = 0;
+
+        const double t0 = now();
+
+        for (size_t t = 0; t + 1 < f.size(); ++t)
+            for (size_t k = f[t]; k < f[t + 1]; ++k)
+            {
+                scm_page page(0, q[k]);
+
+                if (s.search(page, int(t)).is_valid())
+                    hits++;
+
+                else if (int(s.size()) < n)
+                    s.insert(page, int(t));
+
+                else if (s.eject(int(t), page.i, false).is_valid())
+                    s.insert(page, int(t));
+            }
+
+        best = std::min(best, (now() - t0) / q.size());
+    }
+    printf("%-10s %6d slots: %8.1f ns/touch, %5.1f%% hits\n",
+           name, n, 1e9 * best, 100.0 * hits / q.size());
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(std::max(1, atoi(argv[i])));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(  256);
+        sizes.push_back( 1024);
+        sizes.push_back( 4096);
+        sizes.push_back(16384);
+    }
+
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        std::vector<long long> q;
+        std::vector<size_t>    f;
+
+        frames(sizes[i], q, f);
+
+        run<map_set>("std::map", sizes[i], q, f);
+        run<scm_set>("scm_set",  sizes[i], q, f);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+// Compare the latency of a page store hit, with pages held raw and with pages
+// held LZ4-compressed, against that of reading the page from its TIFF anew.
+//
+// Synthetic SCM pages are put in an scm_store of each kind and then fetched in
+// random order. The same pages are written to temporary TIFFs, uncompressed and
+// Deflate-compressed, and read back through scm_load_page. For each source the
+// program reports the mean time per page of the best pass and, for the stores,
+// the number of pages that a 1 GB budget holds.
+//
+//     store [pages [n [c [b [noise]]]]]
+//     store file.tif [pages]
+//
+// The defaults are 256 pages of 256x256 8-bit RGB without noise. Noise is given
+// as a fraction of the value range. As smooth synthetic data may compress quite
+// differently from real imagery, pages may instead be taken from an SCM file.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include <SDL.h>
+#include <tiffio.h>
+
+#include "../scm-store.hpp"
+#include "../scm-file.hpp"
+#include "../scm-lz4.hpp"
+
+//------------------------------------------------------------------------------
+
+static int    pages = 256;
+static int    w     = 258;
+static int    c     =   3;
+static int    b     =   8;
+static size_t size  =   0;
+static double noise = 0.0;
+
+static std::vector<void *> v;   // Source pages
+static std::vector<int>    r;   // Page request order
+
+static double now()
+{
+    return double(SDL_GetPerformanceCounter())
+         / double(SDL_GetPerformanceFrequency());
+}
+
+// Fill a page with smooth terrain-like values plus the given amount of noise.
+
+static void fill(void *p, int k)
+{
+    for     (int y = 0; y < w; ++y)
+        for (int x = 0; x < w; ++x)
+            for (int i = 0; i < c; ++i)
+            {
+                const double s = 0.5 + 0.25 * sin((x + 37 * k) * 0.031 + i)
+                                     + 0.15 * sin((y + 11 * k) * 0.047 - i)
+                                     + 0.05 * sin((x - y) * 0.19)
+                                     + noise * (rand() / double(RAND_MAX));
+
+                const size_t j = (size_t(y) * w + x) * c + i;
+
+                switch (b)
+                {
+                case  8: ((uint8  *) p)[j] = uint8 (s *   255.0); break;
+                case 16: ((uint16 *) p)[j] = uint16(s * 65535.0); break;
+                case 32: ((float  *) p)[j] = float (s);           break;
+                }
+            }
+}
+
+// Write the pages to a BigTIFF, one directory per page, and note the offset of
+// each directory. Return false on failure.
+
+static bool write(const char *name, uint16 z, std::vector<uint64>& o)
+{
+    if (TIFF *T = TIFFOpen(name, "w8"))
+    {
+        const int rows = 32;
+
+        for (size_t k = 0; k < v.size(); ++k)
+        {
+            TIFFSetField(T, TIFFTAG_IMAGEWIDTH,      w);
+            TIFFSetField(T, TIFFTAG_IMAGELENGTH,     w);
+            TIFFSetField(T, TIFFTAG_BITSPERSAMPLE,   b);
+            TIFFSetField(T, TIFFTAG_SAMPLESPERPIXEL, c);
+            TIFFSetField(T, TIFFTAG_ROWSPERSTRIP,    rows);
+            TIFFSetField(T, TIFFTAG_COMPRESSION,     z);
+            TIFFSetField(T, TIFFTAG_PLANARCONFIG,    PLANARCONFIG_CONTIG);
+            TIFFSetField(T, TIFFTAG_PHOTOMETRIC,     c == 3 ? PHOTOMETRIC_RGB
+                                                   : PHOTOMETRIC_MINISBLACK);
+            if (b == 32)
+                TIFFSetField(T, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+            if (z != COMPRESSION_NONE)
+                TIFFSetField(T, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+
+            const tsize_t s = tsize_t(w) * c * b / 8;
+
+            for (int r = 0; r < w; r += rows)
+                TIFFWriteEncodedStrip(T, r / rows, (uint8 *) v[k] + r * s,
+                                      std::min(rows, w - r) * s);
+
+            TIFFWriteDirectory(T);
+        }
+        TIFFClose(T);
+    }
+    if (TIFF *T = TIFFOpen(name, "r"))
+    {
+        o.clear();
+        do
+            o.push_back(uint64(TIFFCurrentDirOffset(T)));
+        while (TIFFReadDirectory(T));
+
+        TIFFClose(T);
+    }
+    return (o.size() == v.size());
+}
+
+//------------------------------------------------------------------------------
+
+// Put every page in a store and time hits in random order.
+
+static void store(const char *name, bool compress)
+{
+    const size_t limit = size_t(1) << 30;
+
+    scm_store S(limit, compress);
+
+    for (int k = 0; k < pages; ++k)
+        if (void *p = malloc(size))
+        {
+            memcpy(p, v[k], size);
+            S.put(scm_item(0, k), p, size);
+        }
+
+    std::vector<char> p(size);
+
+    double best = 1e9;
+    int    miss = 0;
+
+    for (int pass = 0; pass < 5; ++pass)
+    {
+        const double t0 = now();
+
+        for (int k = 0; k < pages; ++k)
+            if (!S.get(scm_item(0, r[k]), &p[0], size))
+                miss++;
+
+        best = std::min(best, (now() - t0) / pages);
+    }
+
+    // Estimate the pages held per budget from the compressed size.
+
+    size_t held = size * pages;
+
+    if (compress)
+    {
+        std::vector<char> q(size);
+
+        held = 0;
+
+        for (int k = 0; k < pages; ++k)
+        {
+            const size_t z = scm_lz4_encode(v[k], size, &q[0], size - 1);
+            held += z ? z : size;
+        }
+    }
+
+    printf("%-14s %10.1f us %12.0f pages/GB%s\n", name, 1e6 * best,
+           double(limit) * pages / double(held), miss ? "  (missed)" : "");
+}
+
+// Write the pages to a TIFF and time reading them in random order.
+
+static void tiff(const char *name, uint16 z)
+{
+    const char *file = "scm-bench-store.tif";
+
+    std::vector<uint64> o;
+
+    if (!TIFFIsCODECConfigured(z) || !write(file, z, o))
+        return;
+
+    std::vector<char> p(size);
+
+    double best = 1e9;
+    int    fail = 0;
+
+    if (TIFF *T = TIFFOpen(file, "r"))
+    {
+        for (int pass = 0; pass < 5; ++pass)
+        {
+            const double t0 = now();
+
+            for (int k = 0; k < pages; ++k)
+                if (!scm_load_page(file, r[k], T, o[r[k]], w, w, c, b, &p[0]))
+                    fail++;
+
+            best = std::min(best, (now() - t0) / pages);
+        }
+        TIFFClose(T);
+    }
+    remove(file);
+
+    printf("%-14s %10.1f us%s\n", name, 1e6 * best, fail ? "  (failed)" : "");
+}
+
+//------------------------------------------------------------------------------
+
+// Read up to the given number of pages from an existing SCM TIFF, taking the
+// page format from its first directory. Return false on failure.
+
+static bool read(const char *name)
+{
+    std::vector<uint64> o;
+
+    if (TIFF *T = TIFFOpen(name, "r"))
+    {
+        uint32 W = 0;
+        uint16 C = 1;
+        uint16 B = 8;
+
+        TIFFGetField(T, TIFFTAG_IMAGEWIDTH,      &W);
+        TIFFGetField(T, TIFFTAG_SAMPLESPERPIXEL, &C);
+        TIFFGetField(T, TIFFTAG_BITSPERSAMPLE,   &B);
+
+        w    = int(W);
+        c    = int(C);
+        b    = int(B);
+        size = size_t(w) * w * c * b / 8;
+
+        // Take the page offsets from the catalog.
+
+        uint64  n = 0;
+        uint64 *q = 0;
+
+        if (TIFFGetField(T, 0xFFB2, &n, &q))
+            for (uint64 j = 0; j < n && int(o.size()) < pages; ++j)
+                if (q[j])
+                    o.push_back(q[j]);
+
+        for (size_t k = 0; k < o.size(); ++k)
+            if (void *p = malloc(size))
+            {
+                if (scm_load_page(name, (long long) k, T, o[k], w, w, c, b, p))
+                    v.push_back(p);
+                else
+                    free(p);
+            }
+        TIFFClose(T);
+    }
+    pages = int(v.size());
+
+    return !v.empty();
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    TIFFSetWarningHandler(0);
+
+    // Read pages from the named file, or synthesize them.
+
+    if (argc > 1 && !isdigit(argv[1][0]))
+    {
+        if (argc > 2) pages = std::max(1, atoi(argv[2]));
+
+        if (!read(argv[1]))
+            return EXIT_FAILURE;
+    }
+    else
+    {
+        if (argc > 1) pages = std::max(1, atoi(argv[1]));
+        if (argc > 2) w     = std::max(1, atoi(argv[2])) + 2;
+        if (argc > 3) c     = std::max(1, atoi(argv[3]));
+        if (argc > 4) b     = std::max(8, atoi(argv[4]));
+        if (argc > 5) noise = atof(argv[5]);
+
+        size = size_t(w) * w * c * b / 8;
+
+        for (int k = 0; k < pages; ++k)
+            if (void *p = malloc(size))
+            {
+                fill(p, k);
+                v.push_back(p);
+            }
+            else return EXIT_FAILURE;
+    }
+
+    for (int k = 0; k < pages; ++k)
+        r.push_back(k);
+
+    std::random_shuffle(r.begin(), r.end());
+
+    printf("%d pages of %dx%d, %d channels of %d bits\n", pages, w, w, c, b);
+    printf("%-14s %13s\n", "source", "time/page");
+
+    store("store raw", false);
+    store("store lz4", true);
+    tiff ("tiff none",    COMPRESSION_NONE);
+    tiff ("tiff deflate", COMPRESSION_ADOBE_DEFLATE);
+
+    for (int k = 0; k < pages; ++k)
+        free(v[k]);
+
+    return EXIT_SUCCESS;
+}
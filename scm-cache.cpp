@@ -12,7 +12,9 @@
 
 #include <GL/glew.h>
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
 #include <limits>
 
@@ -21,6 +23,10 @@
 #include "scm-index.hpp"
 #include "scm-log.hpp"
 
+// The content hash of a page that was not hashed.
+
+static const scm_digest unhashed(0, 0);
+
 //------------------------------------------------------------------------------
 
 /// The cache grid size. The texture atlas will have size N x N where
@@ -30,9 +36,94 @@
 
 int scm_cache::cache_size      = 16;
 
-/// The number of loader threads servicing page load requests for each cache.
-
-int scm_cache::cache_threads   =  2;
+/// If non-zero, the atlas is an array texture, each layer of which holds a grid
+/// of cache_size x cache_size pages, and this value gives its memory budget in
+/// megabytes. The atlas begins with one layer and, rather than eject pages,
+/// doubles its layers as demand requires, within the budget and the limit of
+/// GL_MAX_ARRAY_TEXTURE_LAYERS. If the budget is later reduced, the atlas
+/// shrinks at the next update, ejecting the pages of the layers removed. Each
+/// cache line then gives both a layer and a slot within it, and shaders must
+/// sample the atlas as a sampler2DArray, taking the layer of each page from
+/// the uniform array l. This requires EXT_texture_array and ARB_copy_image.
+/// This value takes effect when each scm_cache is constructed, and changes to
+/// a non-zero budget take effect immediately. @see scm_image::bind_page
+
+int scm_cache::cache_array     =  0;
+
+/// The number of loader threads servicing page load requests. These threads are
+/// shared by all files. If zero, one loader thread is launched per CPU. This
+/// value takes effect when the scm_system is constructed. @see scm_pool
+
+int scm_cache::cache_threads   =  0;
+
+/// If non-zero, pages with 8-bit channels are block-compressed by the loader
+/// threads and held in the atlas as BC1 (RGB), BC4 (luminance), or BC5
+/// (luminance-alpha). An atlas of a given size then holds four to eight times
+/// as many pages, at some loss of quality. Pages are uploaded as stored if
+/// OpenGL lacks the S3TC or LATC formats. This value takes effect when each
+/// scm_cache is constructed. @see scm_format
+
+int scm_cache::cache_compress  =  0;
+
+/// If non-zero, pages with 32-bit float channels are converted to 16-bit floats
+/// by the loader threads, halving the atlas memory and upload bandwidth of such
+/// data. Each file logs the largest resulting error relative to the range of
+/// its page minima and maxima. This value takes effect when each scm_cache is
+/// constructed. @see scm_format
+
+int scm_cache::cache_half      =  0;
+
+/// If non-zero, pages with 8-bit RGB pixels are expanded to BGRA by the loader
+/// threads, the layout that OpenGL uploads without reformatting. This takes a
+/// third more pixel buffer memory but relieves the render thread of the driver's
+/// conversion. It also costs a copy in the loader, as such pages can no longer
+/// be read directly into the pixel buffer. This value takes effect when each
+/// scm_cache is constructed. @see scm_format
+
+int scm_cache::cache_expand    =  0;
+
+/// If non-zero, pages with 16-bit channels are reduced to 8 bits by the loader
+/// threads, halving the atlas memory and upload bandwidth of such data at the
+/// cost of precision. This value takes effect when each scm_cache is
+/// constructed. @see scm_format
+
+int scm_cache::cache_reduce    =  0;
+
+/// If non-zero, the loader threads hash the content of each page, and pages of
+/// identical content share a single atlas line. This benefits data sets with
+/// many repeated pages, such as no-data fill, at the cost of a copy and a hash
+/// of every page. This value takes effect immediately.
+
+int scm_cache::cache_share     =  0;
+
+/// The policy by which pages are ejected from a full atlas. If zero, the least-
+/// recently used page is ejected if it has gone unused for two frames, and
+/// otherwise the deepest page. If one, the same applies, but only among pages
+/// with no children in the atlas, and the root pages are never ejected. This
+/// ensures that a coarser page is always present to stand in for a missing
+/// one. Each cache logs its hit rate, allowing the policies to be compared.
+/// This value takes effect immediately. @see scm_set::eject
+
+int scm_cache::cache_policy    =  0;
+
+/// The number of helper threads decoding the strips of compressed pages. If
+/// non-zero, the strips of each Deflate, LZW, or similar page are divided among
+/// the loader and these helpers, reducing the latency of each page. A helper
+/// needs a libtiff handle of its own, and if the file has none to spare, the
+/// loader decodes that helper's strips itself. If zero, strips are decoded
+/// serially. This value takes effect when the scm_system is constructed.
+/// @see scm_pool @see tiff_handles
+
+int scm_cache::strip_threads   =  0;
+
+/// The maximum number of libtiff handles that each file may hold open. libtiff
+/// reads the first directory, including the whole page catalog, every time a
+/// handle is opened, so each handle costs time and memory. Loaders needing a
+/// handle beyond this count wait for one to be returned. Handles are needed
+/// only for compressed pages and for pages that cannot be copied out of the
+/// file mapping. This value takes effect when each scm_file is opened.
+
+int scm_cache::tiff_handles    =  2;
 
 /// The maximum number of page load requests allowed at any moment. (Requests
 /// from the render thread to the loader threads.) If this limit is exceeded
@@ -49,9 +140,68 @@ int scm_cache::load_queue_size =  8;
 /// The maximum number of page load results that may be uploaded to the atlas
 /// by the render thread each frame. A large value may impact frame rate. A
 /// small value may increase frame latency and/or block the loader threads.
+/// This applies only if upload_budget is zero.
 
 int scm_cache::loads_per_cycle =  2;
 
+/// The time in microseconds that the render thread may spend uploading page
+/// load results to each atlas each frame. Uploads continue until the next is
+/// expected to exceed the budget, as judged by a moving average of the measured
+/// cost of past uploads. At least one page is uploaded each frame. This allows
+/// many pages to arrive in a light frame, such as after a jump to a new view,
+/// and few in a heavy one. Pages of constant value, which the render thread
+/// fills itself, count against the same budget. If zero, loads_per_cycle pages
+/// are uploaded each frame instead. @see get_uploads @see get_backlog
+
+int scm_cache::upload_budget   = 2000;
+
+/// If non-zero and ARB_buffer_storage is supported, page uploads pass through a
+/// single pixel buffer that is mapped once, persistently and coherently, and
+/// divided into page-sized slots. Loaders write directly to their slot, and a
+/// fence guards each slot against reuse until the GPU has read it. This avoids
+/// the buffer orphaning and mapping of each page. Otherwise, each page has its
+/// own pixel buffer, mapped anew per request. This value takes effect when each
+/// scm_cache is constructed.
+
+int scm_cache::upload_persist  =  1;
+
+/// The number of frames a page request may go unrepeated before the request is
+/// considered stale. A loader that receives a stale request abandons it without
+/// reading the page, and its pixel buffer returns to the ring. This avoids the
+/// decoding of pages that have left the view, as when the camera moves quickly.
+/// If zero, requests are never abandoned.
+
+int scm_cache::stale_frames    =  4;
+
+/// The size of the host-memory store of decoded pages, in megabytes. Pages are
+/// retained here after loading, so that a page ejected from a cache atlas and
+/// then requested again is copied from memory rather than read and decoded
+/// anew. Pages of a block-compressed atlas form are kept after conversion. This
+/// budget is separate from that of the atlas, given by cache_size.
+/// If zero, no store is kept. This value takes effect when the scm_system is
+/// constructed. @see scm_store
+
+int scm_cache::store_size      =  0;
+
+/// If non-zero, pages in the host-memory store are compressed using the LZ4
+/// block format, allowing more pages within the same budget. This is most
+/// effective for 8-bit imagery. @see scm_store
+
+int scm_cache::store_compress  =  0;
+
+/// The directory in which to keep persistent caches of decoded pages, one per
+/// SCM file with compressed pages. Pages decoded in one session are re-read
+/// from here in later sessions rather than decoded anew. If empty, no disk
+/// caches are kept. This value takes effect when each scm_file is opened.
+/// @see scm_disk
+
+std::string scm_cache::disk_path;
+
+/// The maximum total size of all disk caches in disk_path, in megabytes.
+/// @see disk_path
+
+int scm_cache::disk_size       = 1024;
+
 //------------------------------------------------------------------------------
 
 /// Create a new page cache with a queue for making page requests
@@ -70,46 +220,66 @@ scm_cache::scm_cache(scm_system *sys, int n, int c, int b) :
     waits(),
     loads(load_queue_size),
     texture(0),
+    target(GL_TEXTURE_2D),
     s(cache_size),
+    d(1),
+    layer_limit(1),
     l(1),
     n(n),
     c(c),
-    b(b)
+    b(b),
+    format(n, c, b),
+    ring(0),
+    ring_data(0),
+    ring_step(0),
+    cancels(0),
+    uploads(0),
+    upload_cost(0),
+    hits(0),
+    misses(0),
+    constants(0),
+    shares(0),
+    line_hash(size_t(s) * size_t(s), unhashed),
+    line_uses(size_t(s) * size_t(s), 0)
 {
-    // Generate pixel buffer objects.
+    mutex = SDL_CreateMutex();
 
-    for (int i = 0; i < 2 * need_queue_size; ++i)
-    {
-        GLuint o;
-        glGenBuffers(1, &o);
-        pbos.push_back(o);
-    }
+    // Generate a persistent pixel buffer ring, if possible.
 
-    // Generate the array texture object.
+    const int m = 2 * need_queue_size;
 
-    GLenum i = scm_internal_form(c, b);
-    GLenum e = scm_external_form(c, b);
-    GLenum y = scm_external_type(c, b);
+    if (upload_persist && GLEW_ARB_buffer_storage && GLEW_ARB_sync)
+        init_ring(m);
 
-    glGenTextures  (1, &texture);
-    glBindTexture  (GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    // Enqueue its slots, or generate pixel buffer objects.
 
-//  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-//  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
-//  glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+    for (int i = 0; i < m; ++i)
+    {
+        GLuint o = GLuint(i);
+
+        if (ring == 0)
+            glGenBuffers(1, &o);
 
-    // Initialize it with a buffer of zeros.
+        pbos.push_back(o);
+    }
 
-    const int m = s * (n + 2);
+    // Choose the atlas texture target.
 
-    if (GLubyte *p = (GLubyte *) calloc(m * m, scm_pixel_size(c, b)))
+    if (cache_array)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, i, m, m, 0, e, y, p);
-        free(p);
+        if (GLEW_EXT_texture_array && GLEW_ARB_copy_image)
+        {
+            target = GL_TEXTURE_2D_ARRAY;
+            glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &layer_limit);
+        }
+        else
+            scm_log("* scm_cache array atlas is not supported");
     }
 
+    // Generate the atlas texture object.
+
+    texture = make_atlas(d);
+
     scm_log("scm_cache constructor %d %d %d", n, c, b);
 }
 
@@ -123,17 +293,32 @@ scm_cache::~scm_cache()
 
     update(0, true);
 
-    // Release the pixel buffer objects.
+    // Release the pixel buffer ring or objects.
 
-    while (!pbos.empty())
-    {
-        glDeleteBuffers(1, &pbos.back());
-        pbos.pop_back();
-    }
+    if (ring)
+        free_ring();
+    else
+        while (!pbos.empty())
+        {
+            glDeleteBuffers(1, &pbos.back());
+            pbos.pop_back();
+        }
 
     // Release the texture.
 
     glDeleteTextures(1, &texture);
+
+    SDL_DestroyMutex(mutex);
+
+    scm_log("scm_cache %llu loads cancelled", (unsigned long long) cancels);
+    scm_log("scm_cache %llu hits %llu misses (%.1f%%) with policy %d",
+            (unsigned long long) hits, (unsigned long long) misses,
+            (hits + misses) ? 100.0 * hits / (hits + misses) : 0.0,
+            cache_policy);
+    scm_log("scm_cache %lu lines shared by constant pages, %llu requests",
+            (unsigned long) consts.size(), (unsigned long long) constants);
+    scm_log("scm_cache %llu uploads avoided by shared lines",
+            (unsigned long long) shares);
 }
 
 /// Add a page request to the load queue
@@ -143,6 +328,29 @@ void scm_cache::add_load(scm_task& task)
     loads.insert(task);
 }
 
+/// Determine whether a page request has gone stale
+///
+/// This is called by a loader before reading a page. If the page has not been
+/// requested by the render thread within the last stale_frames frames, count
+/// its cancellation and return true, leaving the page unread.
+
+bool scm_cache::is_stale(scm_task& task)
+{
+    bool b = false;
+
+    SDL_LockMutex(mutex);
+    {
+        if (stale.find(task) != stale.end())
+        {
+            cancels++;
+            b = true;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    return b;
+}
+
 //------------------------------------------------------------------------------
 
 /// Return the OpenGL texture object representing the cache
@@ -162,8 +370,9 @@ GLuint scm_cache::get_texture() const
 /// @param i Page index
 /// @param t Current time
 /// @param u Time at which the page was loaded.
+/// @param k Priority of the request, the page's on-screen size in pixels
 
-int scm_cache::get_page(int f, long long i, int t, int& u)
+int scm_cache::get_page(int f, long long i, int t, int& u, float k)
 {
     if (scm_file *file = sys->get_file(f))
     {
@@ -174,6 +383,22 @@ int scm_cache::get_page(int f, long long i, int t, int& u)
         if (o == 0)
             return 0;
 
+        // If this page has a single value, return the line shared by all pages
+        // of that value. The page itself is never loaded.
+
+        std::string v;
+
+        if (file->get_page_value(i, v))
+        {
+            int l = get_const(f, i, t, u, v);
+
+            if (l >= 0)
+            {
+                constants++;
+                return l;
+            }
+        }
+
         // If this page is waiting, return the filler.
 
         scm_page wait = waits.search(scm_page(f, i), t);
@@ -190,15 +415,18 @@ int scm_cache::get_page(int f, long long i, int t, int& u)
 
         if (page.is_valid())
         {
+            hits++;
             u    = page.t;
             return page.l;
         }
 
         // Otherwise request the page and add it to the waiting set.
 
-        if (!pbos.empty())
+        misses++;
+
+        if (has_buffer())
         {
-            scm_task task(f, i, o, n, c, b, pbos.deq(), this);
+            scm_task task(f, i, o, n, c, b, k, pbos.deq(), this);
             scm_page page(f, i, 0);
 
             if (file->add_need(task))
@@ -219,27 +447,371 @@ int scm_cache::get_page(int f, long long i, int t, int& u)
     return 0;
 }
 
+// Return the cache line shared by constant pages of value v, or 0 if that line
+// is awaiting upload. If there is no such line, note that one is needed, unless
+// constant pages already hold a quarter of the atlas, in which case return -1
+// and leave the page to be loaded normally. @see put_const
+
+int scm_cache::get_const(int f, long long i, int t, int& u, const std::string& v)
+{
+    std::map<std::string, scm_page>::iterator e = consts.find(v);
+
+    if (e == consts.end())
+    {
+        if (int(consts.size()) >= s * s / 4)
+            return -1;
+
+        e = consts.insert(std::make_pair(v, scm_page(f, i, 0, t))).first;
+    }
+    u = e->second.t;
+    return e->second.l;
+}
+
+// Fill and upload the constant pages awaiting a line, as many as the upload
+// budget of the update begun at time t0 allows, or all of them if requested.
+// These lines are never ejected. Return the number of pages uploaded.
+
+int scm_cache::put_const(int t, Uint64 t0, bool all)
+{
+    const size_t N = size_t(n + 2) * size_t(n + 2);
+
+    std::map<std::string, scm_page>::iterator e;
+
+    int m = 0;
+
+    for (e = consts.begin(); e != consts.end() && has_buffer(); ++e)
+    {
+        if (e->second.l == 0)
+        {
+            if (!all && !can_upload(m, t0))
+                break;
+
+            const std::string& v = e->first;
+
+            void *q = 0;
+            int   l = 0;
+
+            if (format.is_converted() && !(q = malloc(format.get_load_bytes())))
+                break;
+
+            if ((l = get_slot(t, e->second.i)) == 0)
+            {
+                free(q);
+                break;
+            }
+
+            const Uint64 t1 = SDL_GetPerformanceCounter();
+
+            scm_task task(e->second.f, e->second.i, 0, n, c, b, 0.f, pbos.deq(), this);
+
+            // Replicate the value across the page, converting it if needed.
+
+            char *d = (char *) (q ? q : task.p);
+
+            for (size_t j = 0; j < N; ++j)
+                memcpy(d + j * v.size(), v.data(), v.size());
+
+            if (q)
+            {
+                format.convert(q, task.p);
+                free(q);
+            }
+
+            make_page(task, l);
+            pbos.enq(task.u);
+
+            // Update the moving estimate of the upload cost.
+
+            const double dt = 1e6 * double(SDL_GetPerformanceCounter() - t1)
+                                  / double(SDL_GetPerformanceFrequency());
+
+            upload_cost += (dt - upload_cost) / 8.0;
+
+            e->second.l = l;
+            e->second.t = t;
+            m++;
+        }
+    }
+    return m;
+}
+
+// Create a pixel buffer of m page-sized slots and map it persistently. On
+// failure, leave the ring zero so that per-page buffers are used instead.
+
+void scm_cache::init_ring(int m)
+{
+    const GLbitfield bits = GL_MAP_WRITE_BIT
+                          | GL_MAP_PERSISTENT_BIT
+                          | GL_MAP_COHERENT_BIT;
+
+    ring_step = (format.get_page_bytes() + 255) & ~size_t(255);
+
+    const GLsizeiptr size = GLsizeiptr(ring_step * m);
+
+    glGenBuffers(1, &ring);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+    {
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, 0, bits);
+        ring_data = (GLubyte *) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                                                 0, size, bits);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (ring_data)
+    {
+        ring_sync.assign(m, GLsync(0));
+        scm_log("scm_cache persistent upload ring %d x %lu",
+                m, (unsigned long) ring_step);
+    }
+    else
+    {
+        glDeleteBuffers(1, &ring);
+        ring = 0;
+        scm_log("* scm_cache persistent upload ring failed");
+    }
+}
+
+// Release all fences and unmap and delete the pixel buffer ring.
+
+void scm_cache::free_ring()
+{
+    for (size_t i = 0; i < ring_sync.size(); ++i)
+        if (ring_sync[i])
+            glDeleteSync(ring_sync[i]);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+    {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &ring);
+
+    ring_sync.clear();
+    ring_data = 0;
+    ring      = 0;
+    pbos.clear();
+}
+
+/// Return the mapped address of ring slot u
+
+void *scm_cache::get_ring_data(GLuint u) const
+{
+    return ring_data + ring_step * u;
+}
+
+/// Upload ring slot u to the atlas at x, y, z, and fence the slot against
+/// reuse until the GPU has read it.
+
+void scm_cache::put_ring_data(GLuint u, int x, int y, int z)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+    {
+        format.make_texture(target, x, y, z, ring_step * u);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (ring_sync[u])
+        glDeleteSync(ring_sync[u]);
+
+    ring_sync[u] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Upload the page of a task to cache line l.
+
+void scm_cache::make_page(scm_task& task, int l)
+{
+    const int j = get_line_slot(l);
+
+    task.make_page((j % s) * get_slot_size(),
+                   (j / s) * get_slot_size(), get_line_layer(l));
+}
+
+// Return true if a pixel buffer is free for a new request. Slots return to the
+// ring in upload order, so if the GPU has not finished reading the oldest, it
+// has not finished any, and the request waits for a later frame.
+
+bool scm_cache::has_buffer()
+{
+    if (pbos.empty())
+        return false;
+
+    if (ring)
+    {
+        GLsync& sync = ring_sync[pbos.front()];
+
+        if (sync)
+        {
+            if (glClientWaitSync(sync, 0, 0) == GL_TIMEOUT_EXPIRED)
+                return false;
+
+            glDeleteSync(sync);
+            sync = 0;
+        }
+    }
+    return true;
+}
+
+// Generate and bind an atlas texture object of e layers, initialized to zero.
+
+GLuint scm_cache::make_atlas(int e) const
+{
+    GLuint o;
+
+    glGenTextures  (1, &o);
+    glBindTexture  (target, o);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+//  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+//  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
+//  glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+
+    format.init_texture(target, s, e);
+
+    return o;
+}
+
+// Return the number of layers of an array atlas allowed by the cache_array
+// budget and by the implementation limit queried at construction, at least one.
+
+int scm_cache::get_max_layers() const
+{
+    const double z = double(s) * double(s) * double(format.get_page_bytes());
+
+    return std::max(1, std::min(int(layer_limit),
+                                int(cache_array * 1048576.0 / z)));
+}
+
+// Replace the array atlas with one of e layers, copying the content of all
+// layers retained. If shrinking, eject the pages of the layers removed first,
+// and return any constant pages among them to those awaiting a line.
+
+void scm_cache::set_layers(int e)
+{
+    const int L = s * s * e;
+
+    if (e < d)
+    {
+        std::vector<scm_page> v;
+
+        pages.above(L, v);
+
+        for (size_t j = 0; j < v.size(); ++j)
+            pages.remove(v[j]);
+
+        std::map<std::string, scm_page>::iterator k;
+
+        for (k = consts.begin(); k != consts.end(); ++k)
+            if (k->second.l >= L)
+                k->second.l  = 0;
+
+        for (size_t j = L; j < line_hash.size(); ++j)
+            if (line_hash[j] != unhashed)
+                shared.erase(line_hash[j]);
+
+        l = std::min(l, L);
+    }
+
+    line_hash.resize(size_t(L), unhashed);
+    line_uses.resize(size_t(L), 0);
+
+    // Copy the retained layers to a new texture and replace the old.
+
+    const GLsizei M = s * get_slot_size();
+
+    GLuint o = make_atlas(e);
+
+    glCopyImageSubData(texture, target, 0, 0, 0, 0,
+                       o,       target, 0, 0, 0, 0, M, M, std::min(d, e));
+    glDeleteTextures(1, &texture);
+
+    scm_log("scm_cache atlas resized from %d to %d layers", d, e);
+
+    texture = o;
+    d       = e;
+}
+
 /// Find a slot for an incoming page
 ///
-/// Either take the next unused slot or eject a page to make room. Return 0
-// on failure. @see scm_set::eject
+/// Either take the next unused slot, grow an array atlas to provide one, or
+/// eject a page to make room. Return 0 on failure. @see scm_set::eject
 ///
 /// @param t Current time
 /// @param i Page index
 
 int scm_cache::get_slot(int t, long long i)
 {
-    if (l < s * s)
+    if (l < s * s * d)
+        return l++;
+    else if (target == GL_TEXTURE_2D_ARRAY && d < get_max_layers())
+    {
+        set_layers(std::min(2 * d, get_max_layers()));
         return l++;
+    }
     else
     {
-        scm_page victim = pages.eject(t, i);
+        // Eject pages until one releases its line. A line shared by several
+        // pages is released only when the last of them is ejected.
 
-        if (victim.is_valid())
-            return victim.l;
-        else
-            return 0;
+        for (;;)
+        {
+            scm_page victim = pages.eject(t, i, cache_policy != 0);
+
+            if (!victim.is_valid())
+                return 0;
+
+            if (put_line(victim.l))
+                return victim.l;
+        }
+    }
+}
+
+// Return the line holding a page with content hash h, noting its new use, or
+// return 0 if there is no such line.
+
+int scm_cache::get_shared(const scm_digest& h)
+{
+    if (h != unhashed)
+    {
+        std::map<scm_digest, int>::iterator e = shared.find(h);
+
+        if (e != shared.end())
+        {
+            line_uses[e->second]++;
+            shares++;
+            return e->second;
+        }
     }
+    return 0;
+}
+
+// Note that line l now holds a page with content hash h.
+
+void scm_cache::put_shared(const scm_digest& h, int l)
+{
+    line_uses[l] = 1;
+    line_hash[l] = h;
+
+    if (h != unhashed)
+        shared[h] = l;
+}
+
+// Note that a page using line l has been ejected. Return true if the line is
+// now free, forgetting its content.
+
+bool scm_cache::put_line(int l)
+{
+    if (line_uses[l] > 1)
+    {
+        line_uses[l]--;
+        return false;
+    }
+    if (line_hash[l] != unhashed)
+        shared.erase(line_hash[l]);
+
+    line_uses[l] = 0;
+    line_hash[l] = unhashed;
+    return true;
 }
 
 //------------------------------------------------------------------------------
@@ -248,20 +820,34 @@ int scm_cache::get_slot(int t, long long i)
 ///
 /// This should be called by the render thread every frame. If invoked with
 /// the synchronous flag, loop until all page requests in the load queue are
-/// handled.
+/// handled. Otherwise, upload as many pages as upload_budget allows. The number
+/// handled is given by get_uploads, and the number of pages still awaited by
+/// get_backlog.
 ///
 /// @param t Current time
 /// @param b Synchronous?
 
 void scm_cache::update(int t, bool b)
 {
+    const Uint64 t0 = SDL_GetPerformanceCounter();
+
     int c;
 
     scm_task task;
 
-    glBindTexture(GL_TEXTURE_2D, texture);
+    // Shrink an array atlas that exceeds a reduced budget.
+
+    if (target == GL_TEXTURE_2D_ARRAY && cache_array && d > get_max_layers())
+        set_layers(get_max_layers());
+
+    glBindTexture(target, texture);
+
+    // Constant pages come first, as they need no loading and are few. They
+    // count against the same upload budget as loaded pages.
+
+    c = put_const(t, t0, b);
 
-    for (c = 0; (b || c < loads_per_cycle) && loads.try_remove(task); ++c)
+    for (; (b || can_upload(c, t0)) && loads.try_remove(task); ++c)
     {
         if (task.d)
         {
@@ -269,31 +855,105 @@ void scm_cache::update(int t, bool b)
 
             waits.remove(page);
 
-            if (int l = get_slot(t, page.i))
+            // If a line already holds this content, share it. Otherwise take
+            // a new line and upload the page to it.
+
+            if (int l = get_shared(task.h))
             {
                 page.l = l;
                 page.t = t;
                 pages.insert(page, t);
-                task.make_page((l % s) * (n + 2),
-                               (l / s) * (n + 2));
+                task.dump_page();
+            }
+            else if (int l = get_slot(t, page.i))
+            {
+                const Uint64 t1 = SDL_GetPerformanceCounter();
+
+                page.l = l;
+                page.t = t;
+                pages.insert(page, t);
+                make_page(task, l);
+                put_shared(task.h, l);
+
+                // Update the moving estimate of the upload cost.
+
+                const double dt = 1e6 * double(SDL_GetPerformanceCounter() - t1)
+                                      / double(SDL_GetPerformanceFrequency());
+
+                upload_cost += (dt - upload_cost) / 8.0;
             }
             else task.dump_page();
         }
-        else task.dump_page();
+        else
+        {
+            scm_page page(task.f, task.i);
+
+            // The page was not loaded. Forget it so that it may be requested
+            // anew, and ensure that a new request is not judged stale.
+
+            waits.remove(page);
+
+            SDL_LockMutex(mutex);
+            stale.erase(page);
+            SDL_UnlockMutex(mutex);
+
+            task.dump_page();
+        }
 
         pbos.enq(task.u);
     }
+
+    uploads = c;
+
+    get_stale(t);
+}
+
+// Determine whether another page may be uploaded in this update, given that c
+// pages have been uploaded since time t0.
+
+bool scm_cache::can_upload(int c, Uint64 t0) const
+{
+    if (upload_budget > 0)
+    {
+        const double dt = 1e6 * double(SDL_GetPerformanceCounter() - t0)
+                              / double(SDL_GetPerformanceFrequency());
+
+        return (c == 0 || dt + upload_cost <= double(upload_budget));
+    }
+    return (c < loads_per_cycle);
+}
+
+// Publish the set of waiting pages that have not been requested recently, for
+// the attention of the loaders. @see is_stale
+
+void scm_cache::get_stale(int t)
+{
+    std::vector<scm_page> v;
+
+    if (stale_frames > 0)
+        waits.older(t - stale_frames, v);
+
+    SDL_LockMutex(mutex);
+    {
+        stale.clear();
+        stale.insert(v.begin(), v.end());
+    }
+    SDL_UnlockMutex(mutex);
 }
 
 /// Render a 2D overlay of the contents of all caches.
 ///
 /// The parameters are used to format an optimal on-screen array of caches.
+/// An array atlas cannot be shown this way, and is skipped.
 ///
 /// @param ii Cache index
 /// @param nn Cache count
 
 void scm_cache::render(int ii, int nn)
 {
+    if (target != GL_TEXTURE_2D)
+        return;
+
     glPushAttrib(GL_ENABLE_BIT);
     {
         GLint v[4];
@@ -348,7 +1008,13 @@ void scm_cache::render(int ii, int nn)
 void scm_cache::flush()
 {
     while (!pages.empty())
-        pages.eject(0, -1);
+        pages.eject(0, -1, false);
+
+    consts.clear();
+    shared.clear();
+
+    std::fill(line_hash.begin(), line_hash.end(), unhashed);
+    std::fill(line_uses.begin(), line_uses.end(), 0);
 
     l = 1;
 }
@@ -15,13 +15,18 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <set>
 
 #include <GL/glew.h>
+#include <SDL.h>
+#include <SDL_thread.h>
 
 #include "scm-queue.hpp"
 #include "scm-fifo.hpp"
 #include "scm-task.hpp"
 #include "scm-set.hpp"
+#include "scm-format.hpp"
 
 //------------------------------------------------------------------------------
 
@@ -37,21 +42,55 @@ class scm_cache
 public:
 
     static int cache_size;
+    static int cache_array;
     static int cache_threads;
+    static int cache_compress;
+    static int cache_half;
+    static int cache_expand;
+    static int cache_reduce;
+    static int cache_share;
+    static int cache_policy;
+    static int strip_threads;
+    static int tiff_handles;
     static int need_queue_size;
     static int load_queue_size;
     static int loads_per_cycle;
+    static int upload_budget;
+    static int upload_persist;
+    static int stale_frames;
+    static int store_size;
+    static int store_compress;
+    static int disk_size;
+
+    static std::string disk_path;
 
     scm_cache(scm_system *, int, int, int);
    ~scm_cache();
 
     void   add_load(scm_task&);
+    bool   is_stale(scm_task&);
+
+    int    get_grid_size()  const { return s; }
+    int    get_grid_depth() const { return d; }
+    int    get_page_size()  const { return n; }
+    int    get_slot_size()  const { return format.get_slot_size(); }
+
+    const scm_format& get_format() const { return format; }
 
-    int    get_grid_size() const { return s; }
-    int    get_page_size() const { return n; }
+    bool   is_persistent() const { return (ring != 0); }
+    void  *get_ring_data(GLuint) const;
+    void   put_ring_data(GLuint, int, int, int);
+
+    int    get_uploads()     const { return uploads;           }
+    int    get_backlog()     const { return int(waits.size()); }
+    double get_upload_cost() const { return upload_cost;       }
 
     GLuint get_texture() const;
-    int    get_page(int, long long, int, int&);
+    GLenum get_target()  const { return target; }
+
+    int    get_line_layer(int l) const { return l / (s * s); }
+    int    get_line_slot (int l) const { return l % (s * s); }
+    int    get_page(int, long long, int, int&, float);
 
     void   update(int, bool);
     void   render(int, int);
@@ -66,13 +105,54 @@ private:
     scm_fifo <GLuint>   pbos;   // Asynchronous upload ring
 
     GLuint texture;             // Atlas texture object
+    GLenum target;              // Atlas texture target
     int    s;                   // Atlas width and height in pages
+    int    d;                   // Atlas depth in layers
+    GLint  layer_limit;         // Atlas depth limit of the implementation
     int    l;                   // Atlas current page
     int    n;                   // Page width and height in pixels
     int    c;                   // Channels per pixel
     int    b;                   // Bits per channel
 
-    int get_slot(int, long long);
+    scm_format format;          // Atlas page form
+
+    GLuint              ring;      // Persistently-mapped pixel buffer, or 0
+    GLubyte            *ring_data; // Mapped address of the ring
+    size_t              ring_step; // Byte stride of ring slots
+    std::vector<GLsync> ring_sync; // Upload fence of each ring slot, or 0
+
+    SDL_mutex         *mutex;   // Stale set and cancellation count guard
+    std::set<scm_item> stale;   // Waiting pages no longer requested
+    uint64             cancels; // Loads avoided due to staleness
+    int                uploads;     // Pages uploaded in the last update
+    double             upload_cost; // Moving estimate of upload time in us
+
+    uint64             hits;    // Requests finding their page loaded
+    uint64             misses;  // Requests needing their page loaded
+
+    std::map<std::string, scm_page> consts; // Lines of constant pages, by value
+    uint64                      constants;  // Requests served by those lines
+
+    std::map<scm_digest, int> shared;    // Lines of hashed pages, by hash
+    uint64                    shares;    // Uploads avoided by sharing lines
+    std::vector<scm_digest>   line_hash; // Content hash of each line, or zero
+    std::vector<int>          line_uses; // Count of pages using each line
+
+    void init_ring(int);
+    void free_ring();
+    bool has_buffer();
+    bool can_upload(int, Uint64) const;
+    GLuint make_atlas(int) const;
+    int  get_max_layers() const;
+    void set_layers(int);
+    void make_page(scm_task&, int);
+    int  get_slot(int, long long);
+    int  get_shared(const scm_digest&);
+    void put_shared(const scm_digest&, int);
+    bool put_line(int);
+    void get_stale(int);
+    int  get_const(int, long long, int, int&, const std::string&);
+    int  put_const(int, Uint64, bool);
 };
 
 typedef std::vector<scm_cache *>           scm_cache_v;
@@ -0,0 +1,893 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+#include "scm-disk.hpp"
+#include "scm-lz4.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+#ifdef _WIN32
+#define PATH_SEPARATOR '\\'
+#else
+#define PATH_SEPARATOR '/'
+#endif
+
+// The index file header identifies the source file and the slab layout. It is
+// followed by the path of the source file, and then by the records. The slot
+// count is the share of the directory budget claimed by the slab.
+
+struct disk_header
+{
+    char   magic[4];
+    uint32 version;
+    uint64 source_size;
+    uint64 source_time;
+    uint64 page;
+    uint64 clock;
+    uint64 count;
+    uint64 slots;
+    uint64 length;
+};
+
+// Each index file record gives the page held in one occupied slot.
+
+struct disk_record
+{
+    long long i;
+    uint64    t;
+    uint32    k;
+    uint32    z;
+};
+
+static const char   disk_magic[4] = { 'S', 'C', 'M', 'D' };
+static const uint32 disk_version  = 2;
+
+// Determine the size and modification time of the named file.
+
+static bool disk_stat(const std::string& path, uint64& size, uint64& time)
+{
+#ifdef _WIN32
+    struct __stat64 info;
+
+    if (_stat64(path.c_str(), &info) == 0)
+#else
+    struct stat info;
+
+    if (stat(path.c_str(), &info) == 0)
+#endif
+    {
+        size = uint64(info.st_size);
+        time = uint64(info.st_mtime);
+        return true;
+    }
+    return false;
+}
+
+// Hash a string using 64-bit FNV-1a.
+
+static uint64 disk_hash(const std::string& s)
+{
+    uint64 h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        h ^= uint64((unsigned char) s[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// List the names of the files in the given directory having the given suffix.
+
+static void disk_list(const std::string& directory, const std::string& suffix,
+                      std::vector<std::string>& names)
+{
+    const size_t n = suffix.size();
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE           find;
+
+    std::string pattern = directory + PATH_SEPARATOR + "*" + suffix;
+
+    if ((find = FindFirstFileA(pattern.c_str(), &data)) != INVALID_HANDLE_VALUE)
+    {
+        do
+            names.push_back(data.cFileName);
+        while (FindNextFileA(find, &data));
+
+        FindClose(find);
+    }
+#else
+    if (DIR *dir = opendir(directory.c_str()))
+    {
+        while (struct dirent *e = readdir(dir))
+        {
+            std::string name(e->d_name);
+
+            if (name.size() > n && name.compare(name.size() - n, n, suffix) == 0)
+                names.push_back(name);
+        }
+        closedir(dir);
+    }
+#endif
+}
+
+// Read the header and source path of the named index file. Return false if it
+// cannot be read or is not a current index.
+
+static bool disk_read_header(FILE *fp, disk_header& h, std::string& source)
+{
+    if (fread(&h, sizeof (h), 1, fp) == 1
+        && memcmp(h.magic, disk_magic, 4) == 0
+        && h.version == disk_version && h.length < 65536)
+    {
+        std::vector<char> v(size_t(h.length) + 1, 0);
+
+        if (fread(&v[0], 1, size_t(h.length), fp) == size_t(h.length))
+        {
+            source = std::string(&v[0], size_t(h.length));
+            return true;
+        }
+    }
+    return false;
+}
+
+// Seek to a 64-bit offset within a file.
+
+static bool disk_seek(FILE *fp, uint64 o)
+{
+#ifdef _WIN32
+    return (_fseeki64(fp, (__int64) o, SEEK_SET) == 0);
+#else
+    return (fseeko(fp, (off_t) o, SEEK_SET) == 0);
+#endif
+}
+
+// Truncate a file to at most the given size. A shorter file is left alone.
+
+static void disk_shrink(FILE *fp, uint64 o)
+{
+    fflush(fp);
+#ifdef _WIN32
+    if (_fseeki64(fp, 0, SEEK_END) == 0 && uint64(_ftelli64(fp)) > o)
+        _chsize_s(_fileno(fp), (__int64) o);
+#else
+    if (fseeko(fp, 0, SEEK_END) == 0 && uint64(ftello(fp)) > o)
+        if (ftruncate(fileno(fp), (off_t) o) != 0)
+            scm_log("* scm_disk could not truncate slab");
+#endif
+}
+
+// Take an exclusive advisory lock on an open file without waiting. Return
+// false if another handle holds it, whether in this process or another. The
+// lock is released when the file is closed. On Windows a byte far beyond the
+// end of the file is locked, so that reads of the file are not blocked.
+
+static bool disk_lock(FILE *fp)
+{
+#ifdef _WIN32
+    OVERLAPPED o;
+
+    memset(&o, 0, sizeof (o));
+    o.OffsetHigh = 0x40000000;
+
+    return LockFileEx((HANDLE) _get_osfhandle(_fileno(fp)),
+                      LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY,
+                      0, 1, 0, &o) != 0;
+#else
+    return (flock(fileno(fp), LOCK_EX | LOCK_NB) == 0);
+#endif
+}
+
+// Determine whether an open file is still the one at the given path, and has
+// not been removed by another process since it was opened. Windows does not
+// remove open files, so there the answer is always yes.
+
+static bool disk_same(FILE *fp, const std::string& path)
+{
+#ifdef _WIN32
+    return true;
+#else
+    struct stat a;
+    struct stat b;
+
+    return fstat(fileno(fp), &a) == 0 && stat(path.c_str(), &b) == 0
+        && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+// The caches of this process in each directory: those open, by index file
+// name, and the number of bytes by which they may yet grow the directory, which
+// is negative if closed caches exceed the limit. A directory is full if no
+// closed cache remains to be removed to make room.
+
+struct disk_dir
+{
+    disk_dir() : room(0), full(false) { }
+
+    std::map<std::string, scm_disk *> open;
+    long long                         room;
+    bool                              full;
+};
+
+static std::map<std::string, disk_dir> disk_dirs;
+
+// Return the mutex guarding the directory state, creating it on first use.
+
+static SDL_mutex *disk_mutex()
+{
+    static SDL_SpinLock lock  = 0;
+    static SDL_mutex   *mutex = 0;
+
+    SDL_AtomicLock(&lock);
+    {
+        if (mutex == 0)
+            mutex = SDL_CreateMutex();
+    }
+    SDL_AtomicUnlock(&lock);
+
+    return mutex;
+}
+
+//------------------------------------------------------------------------------
+
+/// Open the disk cache of the given SCM file
+///
+/// The cache files are named for a hash of the source path. If an index of a
+/// prior session exists and matches the source file then its pages are reused.
+/// Otherwise the cache begins empty.
+///
+/// The limit applies to all of the caches in the directory together. The caches
+/// open at once in this process divide it evenly, except that none takes more
+/// than it needs to hold every page of its source file, and each open cache is
+/// shrunk or grown to its share as others open. The slab of a closed cache is
+/// removed, least recently used first, only when an open cache must grow and
+/// the directory has no room. A cache that is open, in this process or another,
+/// is never removed. Closed caches whose source file has changed or gone are
+/// removed whenever a cache opens.
+///
+/// While the cache is open its index is locked and holds only a header giving
+/// its claim, so that an abnormal exit leaves an empty cache. If another
+/// process has the same cache open, this one goes without.
+///
+/// @param source    Fully resolved path of the SCM TIFF file
+/// @param directory Directory in which to keep the cache files
+/// @param limit     Maximum size of all slab files in the directory in bytes
+/// @param n         Size of a decoded page in bytes
+/// @param count     Number of pages in the source file
+
+scm_disk::scm_disk(const std::string& source,
+                   const std::string& directory, size_t limit,
+                   uint64 n, uint64 count) :
+    slab(0),
+    lock(0),
+    want(0),
+    extent(0),
+    source_size(0),
+    source_time(0),
+    page(n),
+    clock(0),
+    hits(0),
+    misses(0)
+{
+    mutex = SDL_CreateMutex();
+
+    if (n && disk_stat(source, source_size, source_time))
+    {
+        char hash[32];
+
+        sprintf(hash, "%016llx", (unsigned long long) disk_hash(source));
+
+        const std::string data = directory + PATH_SEPARATOR + hash + ".dat";
+
+        name = directory + PATH_SEPARATOR + hash + ".idx";
+        path = source;
+        dir  = directory;
+        want = std::min(uint64(limit), count * n) / n;
+
+        SDL_LockMutex(disk_mutex());
+
+        disk_dir& D = disk_dirs[dir];
+
+        if (want && D.open.find(name) == D.open.end() && claim())
+        {
+            // Reuse the slab if its index matches. Otherwise begin anew.
+
+            slots.resize(size_t(want));
+
+            if (read_index() && (slab = fopen(data.c_str(), "r+b")))
+            {
+                if (fseek(slab, 0, SEEK_END) == 0)
+                    extent = std::min(want, (uint64(ftell(slab)) + n - 1) / n);
+            }
+            else
+            {
+                slots.assign(size_t(want), slot());
+                pages.clear();
+                order.clear();
+                slab = fopen(data.c_str(), "w+b");
+            }
+
+            // Join the open caches and take a share of the budget.
+
+            if (slab)
+            {
+                D.open[name] = this;
+                sweep(hash, uint64(limit));
+            }
+            else
+            {
+                fclose(lock);
+                lock = 0;
+            }
+        }
+
+        SDL_UnlockMutex(disk_mutex());
+    }
+
+    scm_log("scm_disk constructor %s %llu of %llu pages", source.c_str(),
+            (unsigned long long) pages.size(), (unsigned long long) slots.size());
+}
+
+/// Write the index and close the cache.
+
+scm_disk::~scm_disk()
+{
+    scm_log("scm_disk destructor %llu hits %llu misses", hits, misses);
+
+    if (slab)
+    {
+        // Leave the open set first, so that no other cache resizes this one.
+        // Its slab may now be removed to make room.
+
+        SDL_LockMutex(disk_mutex());
+        {
+            disk_dirs[dir].open.erase(name);
+            disk_dirs[dir].full = false;
+        }
+        SDL_UnlockMutex(disk_mutex());
+
+        fclose(slab);
+        write_index(true);
+        fclose(lock);
+    }
+    SDL_DestroyMutex(mutex);
+}
+
+//------------------------------------------------------------------------------
+
+/// Read a page from the cache
+///
+/// Return false if the page is not present or cannot be read.
+///
+/// @param i Page index
+/// @param p Destination buffer, which must be readable
+/// @param n Destination buffer size in bytes
+
+bool scm_disk::get(long long i, void *p, size_t n)
+{
+    bool   b = false;
+    void  *q = 0;
+    uint32 z = 0;
+
+    SDL_LockMutex(mutex);
+    {
+        std::map<long long, uint32>::iterator j = pages.find(i);
+
+        if (slab && j != pages.end() && uint64(n) == page)
+        {
+            const uint32 k = j->second;
+
+            z = slots[k].z;
+
+            if (disk_seek(slab, uint64(k) * page))
+            {
+                if (z == n)
+                    b = (fread(p, 1, n, slab) == n);
+
+                else if ((q = malloc(z)))
+                    b = (fread(q, 1, z, slab) == z);
+            }
+            touch(k);
+        }
+        if (b) hits++; else misses++;
+    }
+    SDL_UnlockMutex(mutex);
+
+    // Decompress outside of the lock, allowing other loaders to proceed.
+
+    if (q)
+    {
+        b = b && scm_lz4_decode(q, z, p, n);
+        free(q);
+    }
+    return b;
+}
+
+/// Write a page to the cache, replacing the least-recently-used page if full.
+///
+/// The slab grows by one slot at a time, up to the cache's share of the limit,
+/// as long as the directory has room for it.
+///
+/// @param i Page index
+/// @param p Page data
+/// @param n Page data size in bytes
+
+void scm_disk::put(long long i, const void *p, size_t n)
+{
+    if (slab == 0 || uint64(n) != page || n < 2)
+        return;
+
+    // Compress the page, writing it raw if that does not reduce its size.
+
+    void  *q = malloc(n);
+    size_t z = q ? scm_lz4_encode(p, n, q, n - 1) : 0;
+
+    if (z == 0)
+    {
+        free(q);
+        q = 0;
+        z = n;
+    }
+
+    // If every slot of the slab is in use, try to grow it.
+
+    bool grow = false;
+
+    SDL_LockMutex(mutex);
+    grow = (pages.size() >= extent && extent < slots.size());
+    SDL_UnlockMutex(mutex);
+
+    if (grow)
+        grow = reserve();
+
+    SDL_LockMutex(mutex);
+    {
+        if (grow && extent < slots.size())
+        {
+            extent++;
+            grow = false;
+        }
+
+        if (pages.find(i) == pages.end() && extent)
+        {
+            uint32 k;
+
+            // Choose an empty slot or the least-recently-used one.
+
+            if (pages.size() < extent)
+            {
+                for (k = 0; slots[k].i >= 0; ++k)
+                    ;
+            }
+            else
+            {
+                k = order.begin()->second;
+
+                order.erase(order.begin());
+                pages.erase(slots[k].i);
+                slots[k] = slot();
+            }
+
+            if (disk_seek(slab, uint64(k) * page)
+                && fwrite(q ? q : p, 1, z, slab) == z)
+            {
+                slots[k].i = i;
+                slots[k].z = uint32(z);
+                pages[i]   = k;
+                touch(k);
+            }
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    // Give back any room taken but not used.
+
+    if (grow)
+    {
+        SDL_LockMutex(disk_mutex());
+        disk_dirs[dir].room += (long long) page;
+        SDL_UnlockMutex(disk_mutex());
+    }
+    free(q);
+}
+
+//------------------------------------------------------------------------------
+
+// Note the use of slot k.
+
+void scm_disk::touch(uint32 k)
+{
+    if (slots[k].t)
+        order.erase(std::make_pair(slots[k].t, k));
+
+    slots[k].t = ++clock;
+    order.insert(std::make_pair(slots[k].t, k));
+}
+
+// Open and lock the index, creating it if need be, and retrying if another
+// process removes it in the meantime. Return false if another process holds it.
+
+bool scm_disk::claim()
+{
+    for (int tries = 0; tries < 4; ++tries)
+    {
+        if ((lock = fopen(name.c_str(), "r+b")) == 0)
+             lock = fopen(name.c_str(), "w+b");
+
+        if (lock == 0)
+            return false;
+
+        if (!disk_lock(lock))
+        {
+            scm_log("* scm_disk %s is open in another process", name.c_str());
+            fclose(lock);
+            lock = 0;
+            return false;
+        }
+        if (disk_same(lock, name))
+            return true;
+
+        fclose(lock);
+        lock = 0;
+    }
+    return false;
+}
+
+// Change the number of slots to k, dropping the pages held by any slots
+// removed and truncating the slab to match. Rewrite the claim in the index.
+// Return the number of bytes released. The caller holds the directory mutex.
+
+uint64 scm_disk::resize(uint64 k)
+{
+    uint64 r = 0;
+
+    SDL_LockMutex(mutex);
+    {
+        for (size_t j = size_t(k); j < slots.size(); ++j)
+            if (slots[j].i >= 0)
+            {
+                pages.erase(slots[j].i);
+                order.erase(std::make_pair(slots[j].t, uint32(j)));
+            }
+
+        slots.resize(size_t(k));
+
+        if (extent > k)
+        {
+            r      = (extent - k) * page;
+            extent = k;
+            disk_shrink(slab, k * page);
+        }
+        write_index(false);
+    }
+    SDL_UnlockMutex(mutex);
+
+    return r;
+}
+
+// Take room in the directory for one more slot, removing closed caches if need
+// be. Return false if there is no room to be had.
+
+bool scm_disk::reserve()
+{
+    bool b = false;
+
+    SDL_LockMutex(disk_mutex());
+    {
+        disk_dir& D = disk_dirs[dir];
+
+        const long long n = (long long) page;
+
+        if (D.room < n && !D.full)
+        {
+            D.room += (long long) evict(dir, uint64(n - D.room));
+            D.full  = (D.room < n);
+        }
+        if (D.room >= n)
+        {
+            D.room -= n;
+            b = true;
+        }
+    }
+    SDL_UnlockMutex(disk_mutex());
+
+    return b;
+}
+
+// Remove closed caches from the given directory in least-recently-used order
+// until at least the given number of bytes is freed. Return the number freed.
+// A cache is closed if its index is not in this process's open set and is not
+// locked by another process. The caller holds the directory mutex.
+
+uint64 scm_disk::evict(const std::string& directory, uint64 need)
+{
+    std::vector<std::string>                     names;
+    std::vector<std::pair<uint64, std::string> > closed;
+
+    const disk_dir& D = disk_dirs[directory];
+
+    disk_list(directory, ".idx", names);
+
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        const std::string file = directory + PATH_SEPARATOR + names[i];
+
+        uint64 size;
+        uint64 time;
+
+        if (D.open.find(file) == D.open.end() && disk_stat(file, size, time))
+            closed.push_back(std::make_pair(time, names[i]));
+    }
+
+    std::sort(closed.begin(), closed.end());
+
+    uint64 freed = 0;
+
+    for (size_t i = 0; i < closed.size() && freed < need; ++i)
+    {
+        const std::string base = closed[i].second.substr(0,
+                                 closed[i].second.size() - 4);
+        const std::string file = directory + PATH_SEPARATOR + base;
+
+        uint64 size = 0;
+        uint64 time;
+        bool   b    = false;
+
+        if (FILE *fp = fopen((file + ".idx").c_str(), "rb"))
+        {
+            b = disk_lock(fp);
+            fclose(fp);
+        }
+
+        if (b && (!disk_stat(file + ".dat", size, time)
+                  || remove((file + ".dat").c_str()) == 0))
+        {
+            scm_log("scm_disk removing %s", base.c_str());
+            remove((file + ".idx").c_str());
+            freed += size;
+        }
+    }
+    return freed;
+}
+
+// Divide the budget among the caches open in this process in the given
+// directory. Taking the smallest wants first, give each cache all that it
+// wants or an even share of what remains, whichever is less. Resize each to
+// its share, and return the number of bytes released by those that shrink.
+// The caller holds the directory mutex.
+
+uint64 scm_disk::share(const std::string& directory, uint64 budget)
+{
+    std::vector<std::pair<uint64, scm_disk *> > v;
+    std::map<std::string, scm_disk *>::iterator i;
+
+    disk_dir& D = disk_dirs[directory];
+
+    for (i = D.open.begin(); i != D.open.end(); ++i)
+        v.push_back(std::make_pair(i->second->want * i->second->page,
+                                   i->second));
+
+    std::sort(v.begin(), v.end());
+
+    uint64 r = 0;
+
+    for (size_t j = 0; j < v.size(); ++j)
+    {
+        const uint64 n = v[j].second->page;
+        const uint64 k = std::min(v[j].first, budget / (v.size() - j)) / n;
+
+        r      += v[j].second->resize(k);
+        budget -= k * n;
+    }
+    return r;
+}
+
+// Sweep the directory of this cache, not including the cache itself, which has
+// the given base name. Remove each closed cache whose source file has changed
+// or gone, and each slab without an index. Divide what the caches open in other
+// processes leave of the limit among the caches open in this one. Then total
+// the slabs, giving the room left in the directory. The caller holds the
+// directory mutex.
+
+void scm_disk::sweep(const std::string& self, uint64 limit)
+{
+    std::vector<std::string> names;
+    std::set<std::string>    indexed;
+
+    disk_dir& D = disk_dirs[dir];
+
+    uint64 used    = 0;     // Bytes in slabs
+    uint64 foreign = 0;     // Claims of caches open in other processes
+
+    disk_list(dir, ".idx", names);
+
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        const std::string base = names[i].substr(0, names[i].size() - 4);
+        const std::string file = dir + PATH_SEPARATOR + base;
+
+        indexed.insert(base);
+
+        disk_header h;
+        std::string s;
+        uint64      size;
+        uint64      time;
+        bool        stale = false;
+
+        if (base == self || D.open.find(file + ".idx") != D.open.end())
+            continue;
+
+        if (FILE *fp = fopen((file + ".idx").c_str(), "rb"))
+        {
+            if (!disk_lock(fp))
+            {
+                if (disk_read_header(fp, h, s))
+                    foreign += h.slots * h.page;
+            }
+            else if (disk_read_header(fp, h, s)
+                     && disk_stat(s, size, time)
+                     && size == h.source_size
+                     && time == h.source_time)
+            {
+                if (disk_stat(file + ".dat", size, time))
+                    used += size;
+            }
+            else stale = true;
+
+            fclose(fp);
+        }
+
+        if (stale)
+        {
+            scm_log("scm_disk removing stale %s", base.c_str());
+            remove((file + ".idx").c_str());
+            remove((file + ".dat").c_str());
+            indexed.erase(base);
+        }
+    }
+
+    // Remove slabs left without an index.
+
+    names.clear();
+
+    disk_list(dir, ".dat", names);
+
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        const std::string base = names[i].substr(0, names[i].size() - 4);
+
+        if (indexed.find(base) == indexed.end())
+            remove((dir + PATH_SEPARATOR + names[i]).c_str());
+    }
+
+    // Share out what the other processes leave, and total the open slabs.
+
+    const uint64 budget = (foreign < limit) ? limit - foreign : 0;
+
+    share(dir, budget);
+
+    std::map<std::string, scm_disk *>::iterator i;
+
+    for (i = D.open.begin(); i != D.open.end(); ++i)
+        used += i->second->extent * i->second->page;
+
+    D.room = (long long) budget - (long long) used;
+    D.full = false;
+}
+
+// Read the index of a prior session. Return false if it does not exist or if
+// it does not match the source file.
+
+bool scm_disk::read_index()
+{
+    bool b = false;
+
+    if (FILE *fp = lock)
+    {
+        rewind(fp);
+
+        disk_header h;
+        disk_record r;
+        std::string s;
+
+        if (disk_read_header(fp, h, s)
+            && s             == path
+            && h.source_size == source_size
+            && h.source_time == source_time
+            && h.page        == page)
+        {
+            for (uint64 j = 0; j < h.count && fread(&r, sizeof (r), 1, fp); ++j)
+            {
+                // Disregard slots beyond the current size limit.
+
+                if (r.k < slots.size() && r.z <= page && slots[r.k].i < 0
+                                       && pages.find(r.i) == pages.end())
+                {
+                    slots[r.k].i = r.i;
+                    slots[r.k].z = r.z;
+                    slots[r.k].t = r.t;
+                    pages[r.i]   = r.k;
+                    order.insert(std::make_pair(r.t, r.k));
+                }
+            }
+            clock = h.clock;
+            b     = true;
+        }
+    }
+    return b;
+}
+
+// Write the index. When closing, write the records for use by a later session.
+// While open, write only the header, claiming the slab's share of the directory
+// budget. Any old records beyond the header are disregarded.
+
+void scm_disk::write_index(bool records)
+{
+    if (FILE *fp = lock)
+    {
+        rewind(fp);
+
+        disk_header h;
+        disk_record r;
+
+        memcpy(h.magic, disk_magic, 4);
+
+        h.version     = disk_version;
+        h.source_size = source_size;
+        h.source_time = source_time;
+        h.page        = page;
+        h.clock       = clock;
+        h.count       = records ? pages.size() : 0;
+        h.slots       = slots.size();
+        h.length      = path.size();
+
+        fwrite(&h, sizeof (h), 1, fp);
+        fwrite(path.data(), 1, path.size(), fp);
+
+        for (uint32 k = 0; records && k < slots.size(); ++k)
+            if (slots[k].i >= 0)
+            {
+                r.i = slots[k].i;
+                r.t = slots[k].t;
+                r.k = k;
+                r.z = slots[k].z;
+
+                fwrite(&r, sizeof (r), 1, fp);
+            }
+
+        fflush(fp);
+    }
+}
+
+//------------------------------------------------------------------------------
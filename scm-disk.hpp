@@ -0,0 +1,111 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+
+#ifndef SCM_DISK_HPP
+#define SCM_DISK_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <map>
+#include <set>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include <tiffio.h>
+
+//------------------------------------------------------------------------------
+
+/// An scm_disk is a persistent local cache of the decoded pages of one SCM file.
+///
+/// Decoding a JPEG- or Deflate-compressed page can cost far more than reading
+/// it. An scm_disk retains decoded pages, or pages converted to a block-
+/// compressed atlas form, re-encoded using the LZ4 block format, in a slab file
+/// of fixed-size slots with an accompanying index. The index is written when
+/// the cache is closed and read when it is reopened, so repeated
+/// sessions over the same region skip the full decode. The cache is discarded
+/// if the source file changes size or modification time. Slots are reused in
+/// least-recently-used order to keep the slab file within its share of the
+/// size limit, which applies to all caches in the directory together. Caches
+/// open at once divide that limit, closed caches are removed only as open ones
+/// need the room, and no open cache is ever removed. All operations are
+/// thread-safe.
+///
+/// @see scm_cache::disk_path
+/// @see scm_cache::disk_size
+
+class scm_disk
+{
+public:
+
+    scm_disk(const std::string&, const std::string&, size_t, uint64, uint64);
+   ~scm_disk();
+
+    bool is_valid() const { return (slab != 0); }
+
+    bool get(long long, void *, size_t);
+    void put(long long, const void *, size_t);
+
+private:
+
+    /// @cond INTERNAL
+
+    struct slot
+    {
+        slot() : i(-1), z(0), t(0) { }
+
+        long long i;    // Page index
+        uint32    z;    // Stored data size in bytes
+        uint64    t;    // Last use time
+    };
+
+    /// @endcond
+
+    std::string  name;      // Index file name
+    std::string  path;      // Source file name
+    std::string  dir;       // Cache directory
+    FILE        *slab;      // Slab file
+    FILE        *lock;      // Index file, locked while open
+    SDL_mutex   *mutex;
+
+    uint64 want;            // Slots needed to hold every page
+    uint64 extent;          // Slots in use in the slab file
+
+    uint64 source_size;     // Size of the source file
+    uint64 source_time;     // Modification time of the source file
+    uint64 page;            // Page size in bytes
+    uint64 clock;           // Use counter
+
+    std::vector<slot>                      slots;
+    std::map<long long, uint32>            pages;   // Page index to slot
+    std::set<std::pair<uint64, uint32> >   order;   // Slots by last use
+
+    unsigned long long hits;
+    unsigned long long misses;
+
+    void touch(uint32);
+    bool claim();
+    bool reserve();
+    uint64 resize(uint64);
+    bool read_index();
+    void write_index(bool);
+    void sweep(const std::string&, uint64);
+
+    static uint64 evict(const std::string&, uint64);
+    static uint64 share(const std::string&, uint64);
+};
+
+//------------------------------------------------------------------------------
+
+#endif
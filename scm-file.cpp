@@ -10,23 +10,65 @@
 // FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
 // more details.
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 #include "util3d/math3d.h"
 #include "scm-index.hpp"
 #include "scm-cache.hpp"
 #include "scm-file.hpp"
 #include "scm-path.hpp"
+#include "scm-pool.hpp"
+#include "scm-store.hpp"
+#include "scm-disk.hpp"
+#include "scm-pixel.hpp"
 #include "scm-log.hpp"
 
 //------------------------------------------------------------------------------
 
+// The number of page indices in one block of the page index search tree. Eight
+// 64-bit indices fill a typical cache line.
+
+static const uint64 scm_file_block = 8;
+
+// Return the base-two logarithm of k, rounded down.
+
+static inline uint64 ilog2(uint64 k)
+{
+#if defined(__GNUC__)
+    return uint64(63 - __builtin_clzll(k));
+#else
+    uint64 d = 0;
+
+    while (k >>= 1)
+        d++;
+
+    return d;
+#endif
+}
+
+// A strip layout with this strip count records a page whose directory cannot be
+// read through the mapping, so that the directory is parsed only once. A zeroed
+// layout has not yet been parsed.
+
+static const uint32 scm_file_unmapped = 0xFFFFFFFF;
+
+//------------------------------------------------------------------------------
+
 /// Construct a file table entry
 ///
-/// Open the TIFF briefly to determine its format and cache its meta-data.
+/// Determine the format of the TIFF and find its meta-data. If possible, the
+/// page catalog is referenced in place within a memory mapping of the file, so
+/// that the file opens quickly regardless of its size, and catalog entries are
+/// read from disk only as they are used. Otherwise, open the TIFF briefly and
+/// copy the catalog.
 ///
 /// @param name TIFF file name
 /// @param path Fully resolved path and name of TIFF file
@@ -35,69 +77,212 @@ scm_file::scm_file(const std::string& name,
                    const std::string& path) :
     name(name),
     path(path),
+    cache(0),
+    pool(0),
+    store(0),
+    disk(0),
     needs(32),
     active(true),
     sampler(0),
+    map(0),
+    map_pages(0),  map_time(0),
+    tiff_pages(0), tiff_time(0),
+    conv_pages(0), conv_time(0), conv_error(0), conv_range(0),
     w(256), h(256), c(1), b(8),
     xv(0), xc(0),
+    ev(0), ec(0),
+    mc(false),
+    indexer(0),
     ov(0), oc(0),
     av(0), ac(0),
-    zv(0), zc(0)
+    zv(0), zc(0),
+    sv(0)
 {
-    // Attempt to find and load the located TIFF.
+    SDL_AtomicSet(&indexed, 0);
 
     if (!path.empty())
     {
-        if (TIFF *T = TIFFOpen(path.c_str(), "r"))
+        // Map the file to allow uncompressed pages to bypass libtiff.
+
+        if ((map = new scm_map(path)) && !map->is_valid())
         {
-            uint64 n = 0;
-            void  *p = 0;
+            delete map;
+            map = 0;
+        }
+
+        // Reference the catalog in place, or copy it if necessary.
+
+        if (!map_catalog())
+            copy_catalog();
+
+        // Allocate the strip layout table. Its zeroed storage is not resident
+        // until written, and each entry is written when its page is needed.
+
+        if (map && ov && oc)
+            sv = (scm_strips *) calloc(size_t(oc), sizeof (scm_strips));
 
-            // Cache the image parameters.
+        // Note a compression scheme that this libtiff cannot decode.
 
-            TIFFGetField(T, TIFFTAG_IMAGEWIDTH,      &w);
-            TIFFGetField(T, TIFFTAG_IMAGELENGTH,     &h);
-            TIFFGetField(T, TIFFTAG_BITSPERSAMPLE,   &b);
-            TIFFGetField(T, TIFFTAG_SAMPLESPERPIXEL, &c);
+        const uint16 z = get_compression();
 
-            // Preload all metadata.
+        if (!TIFFIsCODECConfigured(z))
+            scm_log("* scm_file %s compression %d is not supported",
+                    path.c_str(), int(z));
 
-            if (TIFFGetField(T, 0xFFB1, &n, &p))
+        // Keep a disk cache of decoded pages if decoding is costly. Pages of a
+        // block-compressed atlas form are kept in that form.
+
+        if (!scm_cache::disk_path.empty() && scm_cache::disk_size > 0
+                                          && z != COMPRESSION_NONE)
+        {
+            const scm_format format(int(w) - 2, c, b);
+
+            disk = new scm_disk(path, scm_cache::disk_path,
+                                size_t(scm_cache::disk_size) << 20,
+                                format.is_compressed()
+                                    ? uint64(format.get_page_bytes())
+                                    : uint64(w) * h * c * b / 8, xc);
+            if (!disk->is_valid())
             {
-                if ((xv = (uint64 *) malloc(size_t(n) * sizeof (uint64))))
-                {
-                    memcpy(xv, p, size_t(n) * sizeof (uint64));
-                    xc = n;
-                }
+                delete disk;
+                disk = 0;
+            }
+        }
+
+        // Build the page index search tree in the background if the catalog
+        // was copied. A mapped catalog is searched in place by bisection,
+        // which touches only the lines it visits, rather than faulting in the
+        // whole index list to build the tree.
+
+        ec = mc ? 0 : (xc + scm_file_block - 1) / scm_file_block;
+
+        if (ec && (ev = (uint64 *) malloc(size_t(ec + 1) * sizeof (uint64))))
+        {
+            int index_catalog(void *);
+
+            if (!(indexer = SDL_CreateThread(index_catalog, "scm-indexer", this)))
+                index_catalog(this);
+        }
+        else ec = 0;
+    }
+    mutex   = SDL_CreateMutex();
+    handles = SDL_CreateSemaphore(Uint32(std::max(scm_cache::tiff_handles, 1)));
+
+    scm_log("scm_file constructor %s", path.c_str());
+}
+
+// Find the image parameters and page catalog in the first directory of the
+// mapped file, and reference the catalog arrays in place. Return false if the
+// file is not mapped, if the catalog arrays are not aligned, or if the file
+// byte order differs from the host, leaving the catalog to be copied.
+
+bool scm_file::map_catalog()
+{
+    if (map)
+    {
+        const uint64 o = map->get_first();
+
+        uint16 type;
+        uint64 n;
+        uint64 v;
+
+        if (map->get_field(o, TIFFTAG_IMAGEWIDTH,      type, n, v))
+            w = uint32(map->get(type, v, 0));
+        if (map->get_field(o, TIFFTAG_IMAGELENGTH,     type, n, v))
+            h = uint32(map->get(type, v, 0));
+        if (map->get_field(o, TIFFTAG_BITSPERSAMPLE,   type, n, v))
+            b = uint16(map->get(type, v, 0));
+        if (map->get_field(o, TIFFTAG_SAMPLESPERPIXEL, type, n, v))
+            c = uint16(map->get(type, v, 0));
+
+        const uint64 k = uint64(b) / 8;
+
+        // Reference each catalog array, abandoning the effort on failure.
+
+        xv = 0; ov = 0; av = 0; zv = 0;
+
+        if (map->get_field(o, 0xFFB1, type, n, v))
+        {
+            if (!(xv = (uint64 *) map->get_array(type, v, n, 8))) return false;
+            xc = n;
+        }
+        if (map->get_field(o, 0xFFB2, type, n, v))
+        {
+            if (!(ov = (uint64 *) map->get_array(type, v, n, 8))) return false;
+            oc = n;
+        }
+        if (map->get_field(o, 0xFFB3, type, n, v))
+        {
+            if (!(av = (void   *) map->get_array(type, v, n, k))) return false;
+            ac = n;
+        }
+        if (map->get_field(o, 0xFFB4, type, n, v))
+        {
+            if (!(zv = (void   *) map->get_array(type, v, n, k))) return false;
+            zc = n;
+        }
+        return (mc = true);
+    }
+    return false;
+}
+
+// Open the TIFF briefly, determine its format, and copy its page catalog.
+
+void scm_file::copy_catalog()
+{
+    xv = 0; xc = 0;
+    ov = 0; oc = 0;
+    av = 0; ac = 0;
+    zv = 0; zc = 0;
+
+    if (TIFF *T = TIFFOpen(path.c_str(), "r"))
+    {
+        uint64 n = 0;
+        void  *p = 0;
+
+        // Cache the image parameters.
+
+        TIFFGetField(T, TIFFTAG_IMAGEWIDTH,      &w);
+        TIFFGetField(T, TIFFTAG_IMAGELENGTH,     &h);
+        TIFFGetField(T, TIFFTAG_BITSPERSAMPLE,   &b);
+        TIFFGetField(T, TIFFTAG_SAMPLESPERPIXEL, &c);
+
+        // Preload all metadata.
+
+        if (TIFFGetField(T, 0xFFB1, &n, &p))
+        {
+            if ((xv = (uint64 *) malloc(size_t(n) * sizeof (uint64))))
+            {
+                memcpy(xv, p, size_t(n) * sizeof (uint64));
+                xc = n;
             }
-            if (TIFFGetField(T, 0xFFB2, &n, &p))
+        }
+        if (TIFFGetField(T, 0xFFB2, &n, &p))
+        {
+            if ((ov = (uint64 *) malloc(size_t(n) * sizeof (uint64))))
             {
-                if ((ov = (uint64 *) malloc(size_t(n) * sizeof (uint64))))
-                {
-                    memcpy(ov, p, size_t(n) * sizeof (uint64));
-                    oc = n;
-                }
+                memcpy(ov, p, size_t(n) * sizeof (uint64));
+                oc = n;
             }
-            if (TIFFGetField(T, 0xFFB3, &n, &p))
+        }
+        if (TIFFGetField(T, 0xFFB3, &n, &p))
+        {
+            if ((av = malloc(size_t(n) * size_t(b) / 8)))
             {
-                if ((av = malloc(size_t(n) * size_t(b) / 8)))
-                {
-                    memcpy(av, p, size_t(n) * size_t(b) / 8);
-                    ac = n;
-                }
+                memcpy(av, p, size_t(n) * size_t(b) / 8);
+                ac = n;
             }
-            if (TIFFGetField(T, 0xFFB4, &n, &p))
+        }
+        if (TIFFGetField(T, 0xFFB4, &n, &p))
+        {
+            if ((zv = malloc(size_t(n) * size_t(b) / 8)))
             {
-                if ((zv = malloc(size_t(n) * size_t(b) / 8)))
-                {
-                    memcpy(zv, p, size_t(n) * size_t(b) / 8);
-                    zc = n;
-                }
+                memcpy(zv, p, size_t(n) * size_t(b) / 8);
+                zc = n;
             }
-            TIFFClose(T);
         }
+        TIFFClose(T);
     }
-    scm_log("scm_file constructor %s", path.c_str());
 }
 
 scm_file::~scm_file()
@@ -108,40 +293,64 @@ scm_file::~scm_file()
 
     if (is_active()) deactivate();
 
-    // Await the exit of each loader.
-
-    int s = 0;
+    // Report the load rate of each read path.
 
-    for (thread_i i = threads.begin(); i != threads.end(); ++i)
-        SDL_WaitThread(*i, &s);
+    if (map_pages)
+        scm_log("scm_file %s mapped %llu pages at %.1f pages/s", path.c_str(),
+                (unsigned long long) map_pages, map_pages / map_time);
+    if (tiff_pages)
+        scm_log("scm_file %s decoded %llu pages at %.1f pages/s", path.c_str(),
+                (unsigned long long) tiff_pages, tiff_pages / tiff_time);
+    if (conv_pages)
+        scm_log("scm_file %s converted %llu pages at %.1f pages/s "
+                "with maximum error %g (%g of page range)", path.c_str(),
+                (unsigned long long) conv_pages, conv_pages / conv_time,
+                conv_error, conv_range);
 
     // Release all resources.
 
+    if (indexer) SDL_WaitThread(indexer, 0);
+
+    while (!tiffs.empty())
+    {
+        TIFFClose(tiffs.back());
+        tiffs.pop_back();
+    }
+    SDL_DestroySemaphore(handles);
+    SDL_DestroyMutex(mutex);
+
     if (sampler) delete sampler;
 
-    free(zv);
-    free(av);
-    free(ov);
-    free(xv);
+    if (!mc)
+    {
+        free(zv);
+        free(av);
+        free(ov);
+        free(xv);
+    }
+    free(ev);
+    free(sv);
+
+    if (disk) delete disk;
+    if (map)  delete map;
 }
 
 //------------------------------------------------------------------------------
 
-/// Launch all loader threads for this file.
+/// Begin servicing page requests for this file using the given loader pool.
+/// If a page store is given then loaded pages are retained in it.
 
-void scm_file::activate(scm_cache *cache)
+void scm_file::activate(scm_cache *cache, scm_pool *pool, scm_store *store)
 {
     this->cache = cache;
+    this->pool  = pool;
+    this->store = store;
 
-    // Launch the loader threads.
-
-    int loader(void *);
-
-    for (int i = 0; i < 2; ++i)
-        threads.push_back(SDL_CreateThread(loader, "scm-loader", this));
+    pool->add_file(this);
 }
 
-/// Command all loader threads to exit.
+/// Cease servicing page requests for this file. Loads already underway run
+/// to completion. @see scm_pool::is_busy
 
 void scm_file::deactivate()
 {
@@ -149,15 +358,7 @@ void scm_file::deactivate()
 
     active.set(false);
 
-    // A non-empty queue ensures that each loader unblocks.
-
-    int t = 1;
-
-    for (thread_i i = threads.begin(); i != threads.end(); ++i, ++t)
-    {
-        scm_task junk(-t, -t);
-        needs.try_insert(junk);
-    }
+    if (pool) pool->del_file(this);
 }
 
 /// Return true if loader threads are active on this file.
@@ -167,11 +368,188 @@ bool scm_file::is_active() const
     return active.get();
 }
 
-/// Insert a new loader task into the needs queue.
+/// Insert a new loader task into the needs queue and notify the loaders. If the
+/// file is mapped, also queue read-ahead of the page so that its data is
+/// resident by the time a loader reaches it.
 
 bool scm_file::add_need(scm_task& task)
 {
-    return needs.try_insert(task);
+    if (needs.try_insert(task))
+    {
+        if (sv) pool->add_read(this, toindex(uint64(task.i)), task.o);
+
+        pool->add_need();
+        return true;
+    }
+    return false;
+}
+
+/// Remove a loader task from the needs queue, if one is available.
+
+bool scm_file::get_need(scm_task& task)
+{
+    return needs.try_remove(task);
+}
+
+/// Begin reading the data of a page in the background. This is called by the
+/// reader thread of the pool.
+///
+/// @param j Page catalog index
+/// @param o TIFF offset
+
+void scm_file::prefetch(uint64 j, uint64 o)
+{
+    scm_strips s;
+
+    if (get_strips(j, o, s))
+        map->prefetch(s);
+}
+
+/// Load a task and pass it along to the cache. This is called by a loader
+/// thread. If the file is no longer active, or if the request has gone stale,
+/// the task is passed along unloaded, allowing the cache to recycle its pixel
+/// buffer.
+
+void scm_file::serve(scm_task& task)
+{
+    if (is_active() && !cache->is_stale(task))
+    {
+        const scm_format& format = cache->get_format();
+
+        if (format.is_compressed())
+            pack (task, format);
+        else if (format.is_converted() || scm_cache::cache_share)
+            stage(task, format);
+        else
+            read(task);
+    }
+    cache->add_load(task);
+}
+
+// Read the page requested by the given task into its pixel buffer, by way of
+// the page store and disk cache if either is in use.
+
+void scm_file::read(scm_task& task)
+{
+    if (store || disk)
+        fetch(task);
+    else
+        load(task);
+}
+
+// Read the page requested by the given task into a temporary buffer and then
+// convert it into the pixel buffer in the atlas form of the cache, or copy it
+// if no conversion is needed. If atlas lines are shared among pages of equal
+// content, hash the page first. Pages in the store and disk cache remain in
+// their loaded form. Block-compressed forms are read by pack instead.
+
+void scm_file::stage(scm_task& task, const scm_format& format)
+{
+    const size_t n = format.get_load_bytes();
+
+    if (void *q = malloc(n))
+    {
+        void *p = task.p;
+
+        task.p = q;
+        read(task);
+        task.p = p;
+
+        if (task.d && scm_cache::cache_share)
+            task.h = scm_hash(q, n);
+
+        if (task.d && !format.is_converted())
+            memcpy(p, q, n);
+
+        if (task.d &&  format.is_converted())
+            convert(task, format, q, p);
+
+        free(q);
+    }
+}
+
+// Read the page requested by the given task in a block-compressed atlas form.
+// Pages in this form are kept in the page store and disk cache as converted, so
+// a page found in either is copied straight to the pixel buffer. Otherwise it
+// is loaded, converted, and given to both. If atlas lines are shared among
+// pages of equal content, hash the page in its converted form.
+
+void scm_file::pack(scm_task& task, const scm_format& format)
+{
+    const size_t n = format.get_page_bytes();
+
+    if (void *q = malloc(n))
+    {
+        void *p = task.p;
+        bool  s = false;    // Give the page to the store?
+        bool  k = false;    // Give the page to the disk cache?
+
+        if (store && store->get(task, q, n))
+            task.d = true;
+
+        else if (disk && disk->get(task.i, q, n))
+            task.d = s = true;
+
+        else if (void *u = malloc(format.get_load_bytes()))
+        {
+            task.p = u;
+
+            if (load(task) && task.d)
+            {
+                convert(task, format, u, q);
+                s = k = true;
+            }
+            task.p = p;
+
+            free(u);
+        }
+
+        if (task.d && scm_cache::cache_share)
+            task.h = scm_hash(q, n);
+
+        if (task.d)
+            memcpy(p, q, n);
+
+        if (k && disk)
+            disk->put(task.i, q, n);
+
+        if (s && store)
+            store->put(task, q, n);
+        else
+            free(q);
+    }
+}
+
+// Convert the page of the given task from loaded form s to atlas form d,
+// noting the time taken and the error introduced.
+
+void scm_file::convert(scm_task& task, const scm_format& format,
+                       const void *s, void *d)
+{
+    const Uint64 t = SDL_GetPerformanceCounter();
+    const double e = format.convert(s, d);
+    const double dt = double(SDL_GetPerformanceCounter() - t)
+                    / double(SDL_GetPerformanceFrequency());
+
+    // Measure the error against the range of values in this page.
+
+    float  r0;
+    float  r1;
+    double er = 0;
+
+    get_page_bounds(uint64(task.i), r0, r1);
+
+    if (r1 > r0)
+        er = e / (r1 - r0);
+
+    SDL_LockMutex(mutex);
+    {
+        conv_pages += 1;
+        conv_time  += dt;
+        conv_error  = std::max(conv_error, e);
+        conv_range  = std::max(conv_range, er);
+    }
+    SDL_UnlockMutex(mutex);
 }
 
 //------------------------------------------------------------------------------
@@ -209,6 +587,37 @@ uint64 scm_file::get_page_offset(uint64 i) const
     return (uint64) (-1);
 }
 
+// Determine whether page i has a single value throughout, as given by equal
+// minimum and maximum in the page catalog. If so, return its pixel value in v.
+
+bool scm_file::get_page_value(uint64 i, std::string& v) const
+{
+    const uint64 j = toindex(i);
+
+    if (j < xc && is_constant(j))
+    {
+        const size_t k = size_t(c) * size_t(b) / 8;
+
+        v.assign((const char *) av + j * k, k);
+        return true;
+    }
+    return false;
+}
+
+// Determine whether the page at catalog index j has equal minimum and maximum
+// in every channel.
+
+bool scm_file::is_constant(uint64 j) const
+{
+    const size_t k = size_t(c) * size_t(b) / 8;
+
+    if (k && (j + 1) * c <= ac && (j + 1) * c <= zc)
+        return memcmp((const char *) av + j * k,
+                      (const char *) zv + j * k, k) == 0;
+    else
+        return false;
+}
+
 // Determine the min and max values of page i. Seek it in the page catalog and
 // reference the corresponding page in the min and max caches. If page i is not
 // represented, assume its parent provides a useful bound and iterate up.
@@ -257,6 +666,293 @@ float scm_file::get_page_sample(const double *v)
     return 0.5f;
 }
 
+// Build the page index search tree of a copied catalog. This is the entry point
+// of a thread launched by the constructor. Until the tree is complete, toindex
+// uses bsearch, as it always does for a mapped catalog.
+
+int index_catalog(void *data)
+{
+    scm_file    *f = (scm_file *) data;
+    const Uint64 t = SDL_GetPerformanceCounter();
+
+    f->eytzinger(0, 1);
+
+    SDL_AtomicSet(&f->indexed, 1);
+
+    scm_log("scm_file %s indexed %llu pages in %.3fs", f->path.c_str(),
+            (unsigned long long) f->xc, double(SDL_GetPerformanceCounter() - t)
+                                      / double(SDL_GetPerformanceFrequency()));
+    return 0;
+}
+
+// Load the page requested by the given task. Copy an uncompressed page straight
+// out of the file mapping, using its parsed strip layout, and fall back upon
+// libtiff if that is not possible. Return false if the page could not be read,
+// in which case it shows an error message.
+
+bool scm_file::load(scm_task& task)
+{
+    const size_t n = size_t(w) * size_t(h) * size_t(c) * size_t(b) / 8;
+    const Uint64 t = SDL_GetPerformanceCounter();
+
+    uint64 j      = toindex(uint64(task.i));
+    bool   mapped = false;
+    bool   r      = true;
+
+    scm_strips s;
+
+    if (get_strips(j, task.o, s) && map->get_pixels(s, task.p, n))
+        task.d = mapped = true;
+
+    if (!mapped)
+    {
+        TIFF *tiff = get_tiff(true);
+
+        if (!load_strips(task, tiff))
+            r = task.load_page(path.c_str(), tiff);
+
+        put_tiff(tiff);
+    }
+
+    const double dt = double(SDL_GetPerformanceCounter() - t)
+                    / double(SDL_GetPerformanceFrequency());
+
+    SDL_LockMutex(mutex);
+    {
+        if (mapped)
+        {
+            map_pages  += 1;
+            map_time   += dt;
+        }
+        else
+        {
+            tiff_pages += 1;
+            tiff_time  += dt;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    return r;
+}
+
+// Find the strip layout of page j at TIFF offset o, parsing the page directory
+// on first use. This may be called by the reader and the loaders at once, and
+// they reach the same result, so the parse is done without the lock and only
+// the copy into and out of the table is guarded. Return false if the page must
+// be read through libtiff.
+
+bool scm_file::get_strips(uint64 j, uint64 o, scm_strips& s)
+{
+    if (sv == 0 || j >= oc || ov[j] != o)
+        return false;
+
+    SDL_LockMutex(mutex);
+    s = sv[j];
+    SDL_UnlockMutex(mutex);
+
+    if (s.n == 0)
+    {
+        if (!map->get_strips(o, w, h, c, b, s))
+        {
+            s   = scm_strips();
+            s.n = scm_file_unmapped;
+        }
+        SDL_LockMutex(mutex);
+        sv[j] = s;
+        SDL_UnlockMutex(mutex);
+    }
+    return (s.n != scm_file_unmapped);
+}
+
+// If strip helpers are available, load a compressed page by dividing its strips
+// among this loader and the helpers. Return false if the page is not suitable,
+// leaving the caller to load it serially and to report any error.
+
+bool scm_file::load_strips(scm_task& task, TIFF *T)
+{
+    uint16 Z = COMPRESSION_NONE;
+    uint32 W, H;
+    uint16 C, B;
+
+    if (T && pool->get_helper_count() && TIFFSetSubDirectory(T, task.o))
+    {
+        TIFFGetField(T, TIFFTAG_IMAGEWIDTH,      &W);
+        TIFFGetField(T, TIFFTAG_IMAGELENGTH,     &H);
+        TIFFGetField(T, TIFFTAG_BITSPERSAMPLE,   &B);
+        TIFFGetField(T, TIFFTAG_SAMPLESPERPIXEL, &C);
+        TIFFGetField(T, TIFFTAG_COMPRESSION,     &Z);
+
+        if (W == w && H == h && B == b && C == c && Z != COMPRESSION_NONE
+                                                 && TIFFIsCODECConfigured(Z))
+        {
+            tsize_t N = TIFFNumberOfStrips(T);
+            tsize_t S = TIFFStripSize(T);
+
+            if (N > 1 && pool->decode(this, T, task.o, N, S, task.p))
+                return (task.d = true);
+        }
+    }
+    return false;
+}
+
+// Decode strip l of S bytes into its place in the page buffer p of n bytes. The
+// final strip may be short, so bound the decode by the space remaining. Return
+// the number of bytes decoded, or -1 on error.
+
+static tsize_t scm_read_strip(TIFF *T, tsize_t l, tsize_t S, tsize_t n, void *p)
+{
+    const tsize_t d = l * S;
+
+    if (d < n)
+        return TIFFReadEncodedStrip(T, uint32(l), (uint8 *) p + d,
+                                    std::min(S, n - d));
+    else
+        return -1;
+}
+
+/// Decode a span of the strips of a page
+///
+/// This is called by the strip helpers of the scm_pool, each of which decodes
+/// its share of a page into its own slice of the destination buffer.
+///
+/// @param T libtiff handle positioned at the page, or null to take one if any
+///          remain, failing otherwise
+/// @param o TIFF offset
+/// @param a First strip
+/// @param z Last strip plus one
+/// @param S Strip size in bytes
+/// @param p Destination pixel buffer
+
+bool scm_file::read_strips(TIFF *T, uint64 o, tsize_t a, tsize_t z,
+                                              tsize_t S, void *p)
+{
+    const tsize_t n = tsize_t(w) * h * c * b / 8;
+
+    TIFF *U = T ? T : get_tiff(false);
+    bool  r = (U != 0);
+
+    if (r && T == 0)
+        r = (TIFFSetSubDirectory(U, o) != 0);
+
+    for (tsize_t l = a; r && l < z; ++l)
+        if (scm_read_strip(U, l, S, n, p) == -1)
+            r = false;
+
+    if (T == 0)
+        put_tiff(U);
+
+    return r;
+}
+
+// Load the page requested by the given task by way of the page store and the
+// disk cache. Copy the page from the store if it is there. Otherwise, read it
+// from the disk cache or load it into a new buffer, copy that to the pixel
+// buffer, and give it to the store. A newly loaded page is also written to the
+// disk cache. The pixel buffer is write-only, so it is never read back.
+
+void scm_file::fetch(scm_task& task)
+{
+    const size_t n = size_t(w) * size_t(h) * size_t(c) * size_t(b) / 8;
+
+    if (store && store->get(task, task.p, n))
+        task.d = true;
+
+    else if (void *q = malloc(n))
+    {
+        void *p = task.p;
+        bool  r = true;
+
+        task.p = q;
+
+        if (disk && disk->get(task.i, q, n))
+            task.d = true;
+        else
+        {
+            if ((r = load(task)) && disk && task.d)
+                disk->put(task.i, q, n);
+        }
+        task.p = p;
+
+        if (task.d)
+            memcpy(p, q, n);
+
+        if (task.d && r && store)
+            store->put(task, q, n);
+        else
+            free(q);
+    }
+    else load(task);
+}
+
+// Determine the compression scheme of the pages of this file, judging by the
+// first page. Examine its directory using the file mapping if possible.
+
+uint16 scm_file::get_compression()
+{
+    uint16 z = COMPRESSION_NONE;
+    uint64 j;
+
+    for (j = 0; j < oc && ov[j] == 0; ++j)
+        ;
+
+    if (j < oc)
+    {
+        scm_strips s;
+
+        if (map && map->get_strips(ov[j], w, h, c, b, s))
+            z = s.z;
+
+        else if (TIFF *T = TIFFOpen(path.c_str(), "r"))
+        {
+            if (TIFFSetSubDirectory(T, ov[j]))
+                TIFFGetField(T, TIFFTAG_COMPRESSION, &z);
+            TIFFClose(T);
+        }
+    }
+    return z;
+}
+
+// Take an idle libtiff handle on this file, opening a new one if necessary. At
+// most tiff_handles are taken at once. If all are taken, wait for one to be
+// returned, or if w is false, return null at once.
+
+TIFF *scm_file::get_tiff(bool w)
+{
+    TIFF *tiff = 0;
+
+    if ((w ? SDL_SemWait(handles) : SDL_SemTryWait(handles)) != 0)
+        return 0;
+
+    SDL_LockMutex(mutex);
+    {
+        if (!tiffs.empty())
+        {
+            tiff = tiffs.back();
+            tiffs.pop_back();
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    if (tiff == 0 && (tiff = TIFFOpen(path.c_str(), "r")) == 0)
+        SDL_SemPost(handles);
+
+    return tiff;
+}
+
+// Return a libtiff handle to the idle list for reuse by any loader.
+
+void scm_file::put_tiff(TIFF *tiff)
+{
+    if (tiff)
+    {
+        SDL_LockMutex(mutex);
+        tiffs.push_back(tiff);
+        SDL_UnlockMutex(mutex);
+
+        SDL_SemPost(handles);
+    }
+}
+
 //------------------------------------------------------------------------------
 
 // Compare two uint64s, for use by bsearch and qsort.
@@ -271,14 +967,93 @@ static int xcmp(const void *p, const void *q)
     else                  return  0;
 }
 
+// Fill the search tree rooted at node k with the first index of each block of
+// xv, in order, beginning with block j. Return the next unused block.
+//
+// The tree is stored in Eytzinger order: the children of node k are nodes 2k
+// and 2k+1. Nodes hold indices only, eight to a cache line, so the sixteen
+// nodes four levels below any node share two lines. The block number of a node
+// is its in-order position, which is computed rather than stored.
+
+uint64 scm_file::eytzinger(uint64 j, uint64 k)
+{
+    if (k <= ec)
+    {
+        j = eytzinger(j, 2 * k);
+
+        ev[k] = xv[j++ * scm_file_block];
+
+        j = eytzinger(j, 2 * k + 1);
+    }
+    return j;
+}
+
+// Return the in-order position of node k of the search tree. The tree is full
+// but for its last level H, which is filled from the left. In a tree full to
+// level H, node k at level d with p nodes to its left is in-order node r =
+// (2p + 1) 2^(H-d) - 1, preceded by (r + 1) / 2 nodes of level H. Those beyond
+// the first L = ec - 2^H + 1 of level H are absent and are not counted.
+
+uint64 scm_file::inorder(uint64 k) const
+{
+    const uint64 H = ilog2(ec);
+    const uint64 d = ilog2(k);
+    const uint64 L = ec - (uint64(1) << H) + 1;
+    const uint64 r = ((2 * (k - (uint64(1) << d)) + 1) << (H - d)) - 1;
+    const uint64 m = (r + 1) / 2;
+
+    return (m > L) ? r - (m - L) : r;
+}
+
 // Determine where SCM index i appears in the sorted index list xv. This will
 // indicate where the file offset and extrema appear in ov, av, and zv.
+//
+// If the catalog is mapped, or its search tree is not yet built, bisect xv.
+// Otherwise, descend the search tree to find the first block beginning after i.
+// The index, if present, lies in the block before that, which fits in a single
+// cache line and is scanned linearly. Each step requests the lines four levels
+// down, so the misses of the lower levels overlap rather than queue.
 
 uint64 scm_file::toindex(uint64 i) const
 {
     void *p;
 
-    if (xc)
+    if (ec && SDL_AtomicGet(&indexed))
+    {
+        uint64 k = 1;
+        uint64 j;
+
+        while (k <= ec)
+        {
+#if defined(__SSE2__) || defined(_M_X64)
+            if (16 * k <= ec)
+            {
+                _mm_prefetch((const char *) (ev + 16 * k),     _MM_HINT_T0);
+                _mm_prefetch((const char *) (ev + 16 * k + 8), _MM_HINT_T0);
+            }
+#endif
+            k = 2 * k + (ev[k] <= i ? 1 : 0);
+        }
+
+        // Undo the right turns that followed the last left turn.
+
+        while (k & 1)
+            k >>= 1;
+
+        k >>= 1;
+
+        if      (k == 0)          j = ec - 1;
+        else if ((j = inorder(k))) j = j - 1;
+        else return (uint64) (-1);
+
+        const uint64 a = j * scm_file_block;
+        const uint64 z = std::min(a + scm_file_block, xc);
+
+        for (j = a; j < z; ++j)
+            if (xv[j] == i)
+                return j;
+    }
+    else if (xc)
     {
         if ((p = bsearch(&i, xv, size_t(xc), sizeof (uint64), xcmp)))
         {
@@ -527,7 +1302,9 @@ void scm_page_text(const char *mesg,
 
 /// Load a page from a TIFF file
 ///
-/// Confirm the image parameters and return success.
+/// Confirm the image parameters and return success. On failure, render an error
+/// message into the destination buffer and return false. Pages may use any
+/// compression scheme configured in libtiff, including Zstandard.
 /// @param name TIFF name
 /// @param i    Page index
 /// @param T    TIFF file
@@ -541,28 +1318,38 @@ void scm_page_text(const char *mesg,
 bool scm_load_page(const char *name, long long i,
                          TIFF *T, uint64 o, int w, int h, int c, int b, void *p)
 {
+    bool r = false;
+
     if (T)
     {
         if (TIFFSetSubDirectory(T, o))
         {
             uint32 W, H;
-            uint16 C, B;
+            uint16 C, B, Z = COMPRESSION_NONE;
 
             TIFFGetField(T, TIFFTAG_IMAGEWIDTH,      &W);
             TIFFGetField(T, TIFFTAG_IMAGELENGTH,     &H);
             TIFFGetField(T, TIFFTAG_BITSPERSAMPLE,   &B);
             TIFFGetField(T, TIFFTAG_SAMPLESPERPIXEL, &C);
+            TIFFGetField(T, TIFFTAG_COMPRESSION,     &Z);
+
+            if (!TIFFIsCODECConfigured(Z))
+                scm_page_text("Unsupported compression", name, i, W, H, C, B, p);
 
-            if (int(W) == w && int(H) == h && int(B) == b && int(C) == c)
+            else if (int(W) == w && int(H) == h && int(B) == b && int(C) == c)
             {
                 tsize_t N = TIFFNumberOfStrips(T);
                 tsize_t S = TIFFStripSize(T);
+                tsize_t n = tsize_t(w) * h * c * b / 8;
+
+                r = true;
 
-                for (int l = 0; l < N; ++l)
+                for (tsize_t l = 0; l < N; ++l)
                 {
-                    if (TIFFReadEncodedStrip(T, l, (uint8 *) p + l * S, -1) == -1)
+                    if (scm_read_strip(T, l, S, n, p) == -1)
                     {
                         scm_page_text("Page read failure", name, i, W, H, C, B, p);
+                        r = false;
                         break;
                     }
                 }
@@ -573,36 +1360,5 @@ bool scm_load_page(const char *name, long long i,
     }
     else scm_page_text("File not found", name, i, w, h, c, b, p);
 
-    return true;
-}
-
-/// Service page load requests
-///
-/// This function is the entry point for loader threads. The void data pointer
-/// gives an scm_file structure with pointers to a needs queue and a cache with
-/// a loads queue. An invalid file request represents an order to shut down.
-
-int loader(void *data)
-{
-    scm_file *file = (scm_file *) data;
-    scm_task  task;
-
-    scm_log("loader thread begin %s", file->path.c_str());
-    {
-        const char *name = file->path.c_str();
-        TIFF       *tiff = TIFFOpen(name, "r");
-
-        while ((task = file->needs.remove()).f >= 0)
-
-            if (file->is_active())
-            {
-                task.load_page(name, tiff);
-                file->cache->add_load(task);
-            }
-            else break;
-
-        if (tiff) TIFFClose(tiff);
-    }
-    scm_log("loader thread end %s", file->path.c_str());
-    return 0;
+    return r;
 }
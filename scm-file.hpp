@@ -24,11 +24,14 @@
 #include "scm-guard.hpp"
 #include "scm-task.hpp"
 #include "scm-sample.hpp"
+#include "scm-map.hpp"
 
 //------------------------------------------------------------------------------
 
-typedef std::vector<SDL_Thread *>           thread_v;
-typedef std::vector<SDL_Thread *>::iterator thread_i;
+class scm_pool;
+class scm_store;
+class scm_disk;
+class scm_format;
 
 //------------------------------------------------------------------------------
 
@@ -43,15 +46,21 @@ public:
 
     virtual ~scm_file();
 
-    void    activate(scm_cache *);
+    void    activate(scm_cache *, scm_pool *, scm_store *);
     void  deactivate();
     bool is_active() const;
 
     bool           add_need(scm_task&);
+    bool           get_need(scm_task&);
+    void             serve (scm_task&);
+    void          prefetch (uint64, uint64);
+
+    bool read_strips(TIFF *, uint64, tsize_t, tsize_t, tsize_t, void *);
 
     virtual bool   get_page_status(uint64)                 const;
     virtual uint64 get_page_offset(uint64)                 const;
     virtual void   get_page_bounds(uint64, float&, float&) const;
+    virtual bool   get_page_value (uint64, std::string&)   const;
     virtual float  get_page_sample(const double *);
 
     virtual uint32 get_w()    const { return w; }
@@ -74,10 +83,27 @@ private:
     // IO handling and threading data
 
     scm_cache          *cache;
+    scm_pool           *pool;
+    scm_store          *store;
+    scm_disk           *disk;
     scm_queue<scm_task> needs;
     scm_guard<bool>     active;
     scm_sample         *sampler;
-    thread_v            threads;
+    scm_map            *map;
+    SDL_mutex          *mutex;
+    SDL_sem            *handles;    ///< Count of libtiff handles not taken
+    std::vector<TIFF *> tiffs;      ///< Idle libtiff handles
+
+    // Load performance statistics
+
+    uint64     map_pages;   ///< Pages copied from the file mapping
+    double     map_time;    ///< Seconds spent copying from the mapping
+    uint64     tiff_pages;  ///< Pages decoded by libtiff
+    double     tiff_time;   ///< Seconds spent decoding with libtiff
+    uint64     conv_pages;  ///< Pages converted to the atlas form
+    double     conv_time;   ///< Seconds spent converting
+    double     conv_error;  ///< Largest error introduced by conversion
+    double     conv_range;  ///< Largest error relative to page value range
 
     // Image parameters
 
@@ -89,6 +115,13 @@ private:
     uint64 *xv;         ///< Page indices
     uint64  xc;         ///< Page indices count
 
+    uint64 *ev;         ///< Page index search tree
+    uint64  ec;         ///< Page index search tree node count
+
+    bool                 mc;        ///< Is the catalog mapped, not copied?
+    mutable SDL_atomic_t indexed;   ///< Is the search tree complete?
+    SDL_Thread          *indexer;   ///< Search tree builder
+
     uint64 *ov;         ///< Page offsets
     uint64  oc;         ///< Page offsets count
 
@@ -98,12 +131,32 @@ private:
     void   *zv;         ///< Page maxima
     uint64  zc;         ///< Page maxima count
 
+    scm_strips *sv;     ///< Page strip layouts, parallel to ov, filled lazily
+
     float  tofloat(const void *, uint64)        const;
     void fromfloat(const void *, uint64, float) const;
 
     uint64 toindex(uint64) const;
-
-    friend int loader(void *);
+    bool is_constant(uint64) const;
+    uint64 eytzinger(uint64, uint64);
+    uint64 inorder(uint64) const;
+
+    bool map_catalog();
+    void copy_catalog();
+    void read(scm_task&);
+    void stage(scm_task&, const scm_format&);
+    void pack (scm_task&, const scm_format&);
+    void convert(scm_task&, const scm_format&, const void *, void *);
+    bool load(scm_task&);
+    void fetch(scm_task&);
+    uint16 get_compression();
+    bool load_strips(scm_task&, TIFF *);
+    bool  get_strips(uint64, uint64, scm_strips&);
+
+    TIFF *get_tiff(bool);
+    void  put_tiff(TIFF *);
+
+    friend int index_catalog(void *);
 };
 
 //------------------------------------------------------------------------------
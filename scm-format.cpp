@@ -0,0 +1,893 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCM_FORMAT_SSSE3
+#define SCM_FORMAT_F16C
+#include <immintrin.h>
+#endif
+
+#include "scm-format.hpp"
+#include "scm-cache.hpp"
+#include "scm-pixel.hpp"
+#include "scm-task.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+// Expand a 5-bit or 6-bit BC1 endpoint channel to 8 bits.
+
+static inline int expand5(int v) { return (v << 3) | (v >> 2); }
+static inline int expand6(int v) { return (v << 2) | (v >> 4); }
+
+// Compute the absolute difference of two channel values.
+
+static inline int absdiff(int a, int b) { return (a < b) ? b - a : a - b; }
+
+// Encode a 4x4 block of 8-bit RGB texels as an 8-byte BC1 block. Take the
+// endpoints from the bounding box of the block, inset slightly to reduce the
+// error at the interpolated colors, and select for each texel the nearest of
+// the four palette colors. Return the largest channel error.
+
+static int encode_bc1(const GLubyte t[16][3], GLubyte *d)
+{
+    int lo[3] = { 255, 255, 255 };
+    int hi[3] = {   0,   0,   0 };
+    int P[4][3];
+    int e = 0;
+
+    for (int i = 0; i < 16; ++i)
+        for (int k = 0; k < 3; ++k)
+        {
+            lo[k] = std::min(lo[k], int(t[i][k]));
+            hi[k] = std::max(hi[k], int(t[i][k]));
+        }
+
+    for (int k = 0; k < 3; ++k)
+    {
+        const int j = (hi[k] - lo[k]) >> 4;
+        lo[k] += j;
+        hi[k] -= j;
+    }
+
+    const int c0 = ((hi[0] * 31 + 127) / 255) << 11
+                 | ((hi[1] * 63 + 127) / 255) <<  5
+                 | ((hi[2] * 31 + 127) / 255);
+    const int c1 = ((lo[0] * 31 + 127) / 255) << 11
+                 | ((lo[1] * 63 + 127) / 255) <<  5
+                 | ((lo[2] * 31 + 127) / 255);
+
+    // Decode the palette as the GPU will see it.
+
+    P[0][0] = expand5(c0 >> 11); P[0][1] = expand6((c0 >> 5) & 63); P[0][2] = expand5(c0 & 31);
+    P[1][0] = expand5(c1 >> 11); P[1][1] = expand6((c1 >> 5) & 63); P[1][2] = expand5(c1 & 31);
+
+    for (int k = 0; k < 3; ++k)
+    {
+        P[2][k] = (2 * P[0][k] +     P[1][k]) / 3;
+        P[3][k] = (    P[0][k] + 2 * P[1][k]) / 3;
+    }
+
+    // Select the nearest palette entry for each texel. If the endpoints are
+    // equal the block is in three-color mode, and only entry zero is usable.
+
+    const int q = (c0 > c1) ? 4 : 1;
+
+    uint32 x = 0;
+
+    for (int i = 0; i < 16; ++i)
+    {
+        int bj = 0;
+        int bd = 1 << 30;
+
+        for (int j = 0; j < q; ++j)
+        {
+            const int dr = t[i][0] - P[j][0];
+            const int dg = t[i][1] - P[j][1];
+            const int db = t[i][2] - P[j][2];
+            const int dd = dr * dr + dg * dg + db * db;
+
+            if (dd < bd)
+            {
+                bd = dd;
+                bj = j;
+            }
+        }
+        for (int k = 0; k < 3; ++k)
+            e = std::max(e, absdiff(t[i][k], P[bj][k]));
+
+        x |= uint32(bj) << (2 * i);
+    }
+
+    d[0] = GLubyte(c0     ); d[1] = GLubyte(c0 >> 8);
+    d[2] = GLubyte(c1     ); d[3] = GLubyte(c1 >> 8);
+    d[4] = GLubyte(x      ); d[5] = GLubyte(x  >> 8);
+    d[6] = GLubyte(x >> 16); d[7] = GLubyte(x  >> 24);
+
+    return e;
+}
+
+// Encode a 4x4 block of 8-bit single-channel texels as an 8-byte BC4 block.
+// Take the endpoints from the range of the block and quantize each texel to
+// the nearest of the eight evenly-spaced palette values. Return the largest
+// error.
+
+static int encode_bc4(const GLubyte t[16], GLubyte *d)
+{
+    int lo = 255;
+    int hi =   0;
+    int P[8];
+    int e = 0;
+
+    for (int i = 0; i < 16; ++i)
+    {
+        lo = std::min(lo, int(t[i]));
+        hi = std::max(hi, int(t[i]));
+    }
+
+    P[0] = hi;
+    P[1] = lo;
+
+    for (int j = 2; j < 8; ++j)
+        P[j] = ((8 - j) * hi + (j - 1) * lo) / 7;
+
+    // Palette entry j lies (8 - j) sevenths of the way from lo to hi, except
+    // for entries zero and one, which are hi and lo themselves.
+
+    static const int map[8] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+
+    uint64 x = 0;
+
+    if (hi > lo)
+        for (int i = 0; i < 16; ++i)
+        {
+            const int j = map[((t[i] - lo) * 7 + (hi - lo) / 2) / (hi - lo)];
+
+            e  = std::max(e, absdiff(t[i], P[j]));
+            x |= uint64(j) << (3 * i);
+        }
+
+    d[0] = GLubyte(hi);
+    d[1] = GLubyte(lo);
+
+    for (int k = 0; k < 6; ++k)
+        d[k + 2] = GLubyte(x >> (8 * k));
+
+    return e;
+}
+
+#ifdef SCM_FORMAT_SSSE3
+
+// The SSSE3 block encoders below give results identical to the scalar encoders
+// above, fitting endpoints and selecting indices for all sixteen texels of a
+// block at once. They are compiled for SSSE3 regardless of the build flags, and
+// must be called only if the CPU supports it.
+
+// Return the least and greatest of sixteen 8-bit values.
+
+__attribute__((target("ssse3")))
+static inline int min_ssse3(__m128i v)
+{
+    v = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+    v = _mm_min_epu8(v, _mm_srli_si128(v, 4));
+    v = _mm_min_epu8(v, _mm_srli_si128(v, 2));
+    v = _mm_min_epu8(v, _mm_srli_si128(v, 1));
+    return _mm_cvtsi128_si32(v) & 0xFF;
+}
+
+__attribute__((target("ssse3")))
+static inline int max_ssse3(__m128i v)
+{
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+    return _mm_cvtsi128_si32(v) & 0xFF;
+}
+
+// Return the squared distances of four texels, given as 16-bit channel
+// differences, as 32-bit values.
+
+__attribute__((target("ssse3")))
+static inline __m128i dist_ssse3(__m128i r, __m128i g, __m128i b, bool hi)
+{
+    const __m128i o = _mm_setzero_si128();
+
+    const __m128i s = hi ? _mm_unpackhi_epi16(r, g) : _mm_unpacklo_epi16(r, g);
+    const __m128i t = hi ? _mm_unpackhi_epi16(b, o) : _mm_unpacklo_epi16(b, o);
+
+    return _mm_add_epi32(_mm_madd_epi16(s, s), _mm_madd_epi16(t, t));
+}
+
+// Encode a 4x4 block of 8-bit RGB texels as BC1. See encode_bc1.
+
+__attribute__((target("ssse3")))
+static int encode_bc1_ssse3(const GLubyte t[16][3], GLubyte *d)
+{
+    const __m128i o = _mm_setzero_si128();
+    const __m128i *v = (const __m128i *) t[0];
+
+    // Separate the texels into planes of red, green, and blue.
+
+    const __m128i a = _mm_loadu_si128(v + 0);
+    const __m128i b = _mm_loadu_si128(v + 1);
+    const __m128i c = _mm_loadu_si128(v + 2);
+
+    const __m128i R = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(a, _mm_setr_epi8( 0,  3,  6,  9, 12, 15, -1, -1,
+                                          -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1,  2,  5,
+                                           8, 11, 14, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                          -1, -1, -1,  1,  4,  7, 10, 13)));
+    const __m128i G = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(a, _mm_setr_epi8( 1,  4,  7, 10, 13, -1, -1, -1,
+                                          -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1,  0,  3,  6,
+                                           9, 12, 15, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                          -1, -1, -1,  2,  5,  8, 11, 14)));
+    const __m128i B = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(a, _mm_setr_epi8( 2,  5,  8, 11, 14, -1, -1, -1,
+                                          -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1,  1,  4,  7,
+                                          10, 13, -1, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                          -1, -1,  0,  3,  6,  9, 12, 15)));
+
+    // Fit the endpoints as the scalar encoder does.
+
+    int lo[3] = { min_ssse3(R), min_ssse3(G), min_ssse3(B) };
+    int hi[3] = { max_ssse3(R), max_ssse3(G), max_ssse3(B) };
+    int P[4][3];
+
+    for (int k = 0; k < 3; ++k)
+    {
+        const int j = (hi[k] - lo[k]) >> 4;
+        lo[k] += j;
+        hi[k] -= j;
+    }
+
+    const int c0 = ((hi[0] * 31 + 127) / 255) << 11
+                 | ((hi[1] * 63 + 127) / 255) <<  5
+                 | ((hi[2] * 31 + 127) / 255);
+    const int c1 = ((lo[0] * 31 + 127) / 255) << 11
+                 | ((lo[1] * 63 + 127) / 255) <<  5
+                 | ((lo[2] * 31 + 127) / 255);
+
+    P[0][0] = expand5(c0 >> 11); P[0][1] = expand6((c0 >> 5) & 63); P[0][2] = expand5(c0 & 31);
+    P[1][0] = expand5(c1 >> 11); P[1][1] = expand6((c1 >> 5) & 63); P[1][2] = expand5(c1 & 31);
+
+    for (int k = 0; k < 3; ++k)
+    {
+        P[2][k] = (2 * P[0][k] +     P[1][k]) / 3;
+        P[3][k] = (    P[0][k] + 2 * P[1][k]) / 3;
+    }
+
+    // Select the nearest palette entry for each texel, four texels at a time,
+    // preferring the lower entry in a tie.
+
+    const int q = (c0 > c1) ? 4 : 1;
+
+    __m128i J[4];
+
+    for (int h = 0; h < 2; ++h)
+    {
+        const __m128i r = h ? _mm_unpackhi_epi8(R, o) : _mm_unpacklo_epi8(R, o);
+        const __m128i g = h ? _mm_unpackhi_epi8(G, o) : _mm_unpacklo_epi8(G, o);
+        const __m128i s = h ? _mm_unpackhi_epi8(B, o) : _mm_unpacklo_epi8(B, o);
+
+        __m128i D[2];
+
+        for (int j = 0; j < q; ++j)
+        {
+            const __m128i dr = _mm_sub_epi16(r, _mm_set1_epi16(short(P[j][0])));
+            const __m128i dg = _mm_sub_epi16(g, _mm_set1_epi16(short(P[j][1])));
+            const __m128i db = _mm_sub_epi16(s, _mm_set1_epi16(short(P[j][2])));
+
+            for (int i = 0; i < 2; ++i)
+            {
+                const __m128i dd = dist_ssse3(dr, dg, db, i == 1);
+
+                if (j == 0)
+                {
+                    D[i]         = dd;
+                    J[h * 2 + i] = o;
+                }
+                else
+                {
+                    const __m128i m = _mm_cmplt_epi32(dd, D[i]);
+
+                    D[i]         = _mm_or_si128(_mm_and_si128(m, dd),
+                                             _mm_andnot_si128(m, D[i]));
+                    J[h * 2 + i] = _mm_or_si128(_mm_and_si128(m, _mm_set1_epi32(j)),
+                                             _mm_andnot_si128(m, J[h * 2 + i]));
+                }
+            }
+        }
+    }
+
+    const __m128i x = _mm_packus_epi16(_mm_packs_epi32(J[0], J[1]),
+                                       _mm_packs_epi32(J[2], J[3]));
+
+    // Measure the error at the selected palette entries.
+
+    const __m128i pr = _mm_setr_epi8(char(P[0][0]), char(P[1][0]),
+                                     char(P[2][0]), char(P[3][0]),
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pg = _mm_setr_epi8(char(P[0][1]), char(P[1][1]),
+                                     char(P[2][1]), char(P[3][1]),
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pb = _mm_setr_epi8(char(P[0][2]), char(P[1][2]),
+                                     char(P[2][2]), char(P[3][2]),
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    const __m128i er = _mm_shuffle_epi8(pr, x);
+    const __m128i eg = _mm_shuffle_epi8(pg, x);
+    const __m128i eb = _mm_shuffle_epi8(pb, x);
+
+    const __m128i E = _mm_max_epu8(_mm_max_epu8(
+        _mm_sub_epi8(_mm_max_epu8(R, er), _mm_min_epu8(R, er)),
+        _mm_sub_epi8(_mm_max_epu8(G, eg), _mm_min_epu8(G, eg))),
+        _mm_sub_epi8(_mm_max_epu8(B, eb), _mm_min_epu8(B, eb)));
+
+    // Pack the 2-bit indices, four texels to a byte.
+
+    const __m128i w = _mm_madd_epi16(_mm_maddubs_epi16(x, _mm_set1_epi16(0x0401)),
+                                     _mm_set1_epi32(0x00100001));
+    int y[4];
+
+    _mm_storeu_si128((__m128i *) y, w);
+
+    d[0] = GLubyte(c0     ); d[1] = GLubyte(c0 >> 8);
+    d[2] = GLubyte(c1     ); d[3] = GLubyte(c1 >> 8);
+    d[4] = GLubyte(y[0]   ); d[5] = GLubyte(y[1]   );
+    d[6] = GLubyte(y[2]   ); d[7] = GLubyte(y[3]   );
+
+    return max_ssse3(E);
+}
+
+// Encode a 4x4 block of 8-bit single-channel texels as BC4. See encode_bc4.
+
+__attribute__((target("ssse3")))
+static int encode_bc4_ssse3(const GLubyte t[16], GLubyte *d)
+{
+    const __m128i o = _mm_setzero_si128();
+    const __m128i v = _mm_loadu_si128((const __m128i *) t);
+
+    const int lo = min_ssse3(v);
+    const int hi = max_ssse3(v);
+    int       e  = 0;
+    uint64    x  = 0;
+
+    if (hi > lo)
+    {
+        // Quantize each texel. The quotient is exact in single precision.
+
+        const __m128i u = _mm_sub_epi8(v, _mm_set1_epi8(char(lo)));
+        const __m128i k = _mm_set1_epi16(7);
+        const __m128i r = _mm_set1_epi16(short((hi - lo) / 2));
+        const __m128  f = _mm_set1_ps(float(hi - lo));
+
+        const __m128i a = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(u, o), k), r);
+        const __m128i b = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(u, o), k), r);
+
+        const __m128i a0 = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(a, o)), f));
+        const __m128i a1 = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(a, o)), f));
+        const __m128i b0 = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(b, o)), f));
+        const __m128i b1 = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(b, o)), f));
+
+        const __m128i z = _mm_packus_epi16(_mm_packs_epi32(a0, a1),
+                                           _mm_packs_epi32(b0, b1));
+
+        // Map each quotient to its palette entry, as in encode_bc4.
+
+        const __m128i j = _mm_shuffle_epi8(_mm_setr_epi8(1, 7, 6, 5, 4, 3, 2, 0,
+                                                         0, 0, 0, 0, 0, 0, 0, 0), z);
+        char P[8];
+
+        P[0] = char(hi);
+        P[1] = char(lo);
+
+        for (int i = 2; i < 8; ++i)
+            P[i] = char(((8 - i) * hi + (i - 1) * lo) / 7);
+
+        const __m128i p = _mm_shuffle_epi8(_mm_setr_epi8(P[0], P[1], P[2], P[3],
+                                                         P[4], P[5], P[6], P[7],
+                                                         0, 0, 0, 0, 0, 0, 0, 0), j);
+
+        e = max_ssse3(_mm_sub_epi8(_mm_max_epu8(v, p), _mm_min_epu8(v, p)));
+
+        // Pack the 3-bit indices, four texels to twelve bits.
+
+        const __m128i w = _mm_madd_epi16(_mm_maddubs_epi16(j, _mm_set1_epi16(0x0801)),
+                                         _mm_set1_epi32(0x00400001));
+        int y[4];
+
+        _mm_storeu_si128((__m128i *) y, w);
+
+        x = uint64(y[0])       | uint64(y[1]) << 12
+          | uint64(y[2]) << 24 | uint64(y[3]) << 36;
+    }
+
+    d[0] = GLubyte(hi);
+    d[1] = GLubyte(lo);
+
+    for (int k = 0; k < 6; ++k)
+        d[k + 2] = GLubyte(x >> (8 * k));
+
+    return e;
+}
+
+#endif
+
+// Convert a 32-bit float to a 16-bit float, rounding to nearest even.
+
+static uint16 tohalf(float f)
+{
+    uint32 x;
+
+    memcpy(&x, &f, sizeof (uint32));
+
+    const uint32 s = (x >> 16) & 0x8000;
+    const int    e = int((x >> 23) & 0xFF) - 112;
+    uint32       m = (x & 0x7FFFFF);
+
+    if (e == 143)
+        return uint16(s | 0x7C00 | (m ? 0x200 : 0));    // Infinity or NaN
+    if (e >= 31)
+        return uint16(s | 0x7C00);                      // Overflow
+    if (e <= 0)
+    {
+        if (e < -10)
+            return uint16(s);                           // Underflow
+
+        const int    k = 14 - e;                        // Subnormal
+        const uint32 r = (m | 0x800000) & ((1U << k) - 1);
+        uint32       h = (m | 0x800000) >> k;
+
+        if (r > (1U << (k - 1)) || (r == (1U << (k - 1)) && (h & 1)))
+            h++;
+
+        return uint16(s | h);
+    }
+
+    uint32 h = (uint32(e) << 10) | (m >> 13);
+    uint32 r = (m & 0x1FFF);
+
+    if (r > 0x1000 || (r == 0x1000 && (h & 1)))
+        h++;
+
+    return uint16(s | h);
+}
+
+// Convert a 16-bit float to a 32-bit float.
+
+static float fromhalf(uint16 h)
+{
+    uint32 s = uint32(h & 0x8000) << 16;
+    uint32 e = (h >> 10) & 0x1F;
+    uint32 m = (h & 0x3FF);
+    uint32 x;
+    float  f;
+
+    if (e == 0)
+    {
+        if (m)
+        {
+            for (e = 113; (m & 0x400) == 0; --e)
+                m <<= 1;
+
+            x = s | (e << 23) | ((m & 0x3FF) << 13);
+        }
+        else x = s;
+    }
+    else if (e == 31)
+        x = s | 0x7F800000 | (m << 13);
+    else
+        x = s | ((e + 112) << 23) | (m << 13);
+
+    memcpy(&f, &x, sizeof (float));
+    return f;
+}
+
+#ifdef SCM_FORMAT_F16C
+
+// Convert 32-bit floats to 16-bit floats eight at a time using the F16C
+// instructions, raising e to the largest absolute error. Return the count
+// converted, leaving any remainder to the caller. This function is compiled for
+// F16C regardless of the build flags, and must be called only if the CPU
+// supports it.
+
+__attribute__((target("avx,f16c")))
+static size_t half_f16c(const float *s, uint16 *d, size_t k, float& e)
+{
+    const __m256 a = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256       E = _mm256_setzero_ps();
+    size_t       i = 0;
+
+    for (; i + 8 <= k; i += 8)
+    {
+        const __m256  f = _mm256_loadu_ps(s + i);
+        const __m128i h = _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT);
+        const __m256  g = _mm256_cvtph_ps(h);
+
+        _mm_storeu_si128((__m128i *) (d + i), h);
+
+        E = _mm256_max_ps(E, _mm256_and_ps(_mm256_sub_ps(f, g), a));
+    }
+
+    float v[8];
+
+    _mm256_storeu_ps(v, E);
+
+    for (int j = 0; j < 8; ++j)
+        if (v[j] > e) e = v[j];
+
+    return i;
+}
+
+#endif
+
+// Convert k 32-bit floats to 16-bit floats, returning the largest absolute
+// error. Use the F16C instructions eight at a time where the CPU allows.
+
+static double half_page(const float *s, uint16 *d, size_t k)
+{
+    float  e = 0;
+    size_t i = 0;
+
+#ifdef SCM_FORMAT_F16C
+    static const bool f16c = __builtin_cpu_supports("avx")
+                          && __builtin_cpu_supports("f16c");
+    if (f16c)
+        i = half_f16c(s, d, k, e);
+#endif
+
+    for (; i < k; ++i)
+    {
+        const float t = std::fabs(s[i] - fromhalf(d[i] = tohalf(s[i])));
+
+        if (t > e) e = t;
+    }
+    return double(e);
+}
+
+//------------------------------------------------------------------------------
+
+/// Select the atlas form for pages of the given size and sample format
+///
+/// Block compression is used if requested by scm_cache::cache_compress, if the
+/// pages have 8-bit channels, and if OpenGL supports the compressed format.
+/// Single-channel pages become BC4, luminance-
+/// alpha pages become BC5, and RGB pages become BC1. Pages with 32-bit float
+/// channels become 16-bit floats if requested by scm_cache::cache_half, and
+/// pages with 16-bit channels become 8-bit if requested by cache_reduce. RGB
+/// pages not otherwise converted are expanded to BGRA if requested by
+/// cache_expand. Other pages are uploaded as stored.
+///
+/// @param n Page size in pixels, not including the border
+/// @param c Channels per pixel
+/// @param b Bits per channel
+
+scm_format::scm_format(int n, int c, int b) :
+    n(n + 2), c(c), b(b), m(n + 2), form(form_none)
+{
+    if (scm_cache::cache_compress && b == 8)
+        switch (c)
+        {
+        case 1: form = form_bc4; break;
+        case 2: form = form_bc5; break;
+        case 3: form = form_bc1; break;
+        }
+
+    if ((form == form_bc1 && !GLEW_EXT_texture_compression_s3tc) ||
+        (form == form_bc4 && !GLEW_EXT_texture_compression_latc) ||
+        (form == form_bc5 && !GLEW_EXT_texture_compression_latc))
+    {
+        scm_log("* scm_format block compression is not supported");
+        form = form_none;
+    }
+
+    if (scm_cache::cache_half && b == 32)
+        form = form_half;
+
+    if (scm_cache::cache_reduce && b == 16)
+        form = form_byte;
+
+    if (scm_cache::cache_expand && b == 8 && c == 3 && form == form_none)
+        form = form_bgra;
+
+    if (is_compressed())
+        m = (this->n + 3) & ~3;
+}
+
+/// Return the size of the pixel buffer needed to upload one page.
+
+size_t scm_format::get_page_bytes() const
+{
+    if (is_compressed())
+        return size_t(m / 4) * size_t(m / 4) * (form == form_bc5 ? 16 : 8);
+    else
+        return size_t(n) * size_t(n) * get_pixel_size();
+}
+
+/// Return the size of one page as loaded from the SCM file.
+
+size_t scm_format::get_load_bytes() const
+{
+    return size_t(n) * size_t(n) * scm_pixel_size(c, b);
+}
+
+/// Allocate storage for an atlas of s x s slots for the bound texture, and
+/// initialize it to zero. An array texture receives d such layers.
+///
+/// @param t Texture target, GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+/// @param s Atlas width and height in slots
+/// @param d Atlas depth in layers
+
+void scm_format::init_texture(GLenum t, int s, int d) const
+{
+    const int M = s * m;
+
+    if (is_compressed())
+    {
+        const size_t z = size_t(s) * size_t(s) * get_page_bytes();
+
+        if (GLubyte *p = (GLubyte *) calloc(z, d))
+        {
+            if (t == GL_TEXTURE_2D_ARRAY)
+                glCompressedTexImage3D(t, 0, get_internal(),
+                                       M, M, d, 0, GLsizei(z * d), p);
+            else
+                glCompressedTexImage2D(t, 0, get_internal(),
+                                       M, M,    0, GLsizei(z), p);
+            free(p);
+        }
+    }
+    else
+    {
+        const size_t z = size_t(M) * size_t(M) * get_pixel_size();
+
+        if (GLubyte *p = (GLubyte *) calloc(z, d))
+        {
+            if (t == GL_TEXTURE_2D_ARRAY)
+                glTexImage3D(t, 0, get_internal(), M, M, d, 0,
+                             get_external(), get_type(), p);
+            else
+                glTexImage2D(t, 0, get_internal(), M, M,    0,
+                             get_external(), get_type(), p);
+            free(p);
+        }
+    }
+}
+
+/// Copy one page from the bound pixel buffer to the bound texture.
+///
+/// @param t Texture target, GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+/// @param x Location of upper-left pixel
+/// @param y Location of upper-left pixel
+/// @param z Layer of an array texture
+/// @param o Offset of the page within the pixel buffer
+
+void scm_format::make_texture(GLenum t, int x, int y, int z, size_t o) const
+{
+    const GLvoid *p = (const GLubyte *) 0 + o;
+
+    if (t == GL_TEXTURE_2D_ARRAY)
+    {
+        if (is_compressed())
+            glCompressedTexSubImage3D(t, 0, x, y, z, m, m, 1, get_internal(),
+                                      GLsizei(get_page_bytes()), p);
+        else
+            glTexSubImage3D(t, 0, x, y, z, n, n, 1,
+                            get_external(), get_type(), p);
+    }
+    else
+    {
+        if (is_compressed())
+            glCompressedTexSubImage2D(t, 0, x, y, m, m, get_internal(),
+                                      GLsizei(get_page_bytes()), p);
+        else
+            glTexSubImage2D(t, 0, x, y, n, n,
+                            get_external(), get_type(), p);
+    }
+}
+
+/// Convert one page from the loaded form to the atlas form
+///
+/// This is called by a loader thread. Return the largest error introduced in
+/// any channel, with 8-bit and 16-bit data normalized to the range 0 to 1 and
+/// floating point data in its own units, as with page minima and maxima.
+///
+/// @param s Source page of get_load_bytes size
+/// @param d Destination page of get_page_bytes size
+
+double scm_format::convert(const void *s, void *d) const
+{
+    switch (form)
+    {
+    case form_half: return to_half  (s, d);
+    case form_bgra: return to_bgra  (s, d);
+    case form_byte: return to_byte  (s, d);
+    case form_bc1:
+    case form_bc4:
+    case form_bc5:  return to_blocks(s, d);
+    default:        return 0.0;
+    }
+}
+
+// Encode a page as 4x4 blocks. Block-compressed forms cover the whole slot, so
+// the page is extended to the slot size by repeating its last row and column.
+
+double scm_format::to_blocks(const void *s, void *d) const
+{
+    const GLubyte *p = (const GLubyte *) s;
+    GLubyte       *q = (GLubyte       *) d;
+
+    GLubyte t[2][16];
+    GLubyte u[16][3];
+
+    int e = 0;
+
+    // Select the block encoders, using SSSE3 where the CPU allows.
+
+    int (*bc1)(const GLubyte[16][3], GLubyte *) = encode_bc1;
+    int (*bc4)(const GLubyte[16],    GLubyte *) = encode_bc4;
+
+#ifdef SCM_FORMAT_SSSE3
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+
+    if (ssse3)
+    {
+        bc1 = encode_bc1_ssse3;
+        bc4 = encode_bc4_ssse3;
+    }
+#endif
+
+    for     (int by = 0; by < m; by += 4)
+        for (int bx = 0; bx < m; bx += 4)
+        {
+            // Gather the texels of this block.
+
+            for     (int j = 0; j < 4; ++j)
+                for (int i = 0; i < 4; ++i)
+                {
+                    const int x = std::min(bx + i, n - 1);
+                    const int y = std::min(by + j, n - 1);
+                    const GLubyte *r = p + (size_t(y) * n + x) * c;
+
+                    for (int k = 0; k < c; ++k)
+                    {
+                        if (c == 3)
+                            u[j * 4 + i][k] = r[k];
+                        else
+                            t[k][j * 4 + i] = r[k];
+                    }
+                }
+
+            // Encode it.
+
+            switch (form)
+            {
+            case form_bc1:
+                e = std::max(e, bc1(u, q));
+                q += 8;
+                break;
+            case form_bc4:
+                e = std::max(e, bc4(t[0], q));
+                q += 8;
+                break;
+            case form_bc5:
+                e = std::max(e, bc4(t[0], q));
+                q += 8;
+                e = std::max(e, bc4(t[1], q));
+                q += 8;
+                break;
+            }
+        }
+    return double(e) / 255.0;
+}
+
+// Expand a page of 8-bit RGB to 8-bit BGRA. This is lossless.
+
+double scm_format::to_bgra(const void *s, void *d) const
+{
+    scm_expand_rgb(s, d, size_t(n) * n);
+    return 0.0;
+}
+
+// Reduce a page of 16-bit channels to 8 bits. Rounding to nearest, the error
+// is at most 128 in 65535.
+
+double scm_format::to_byte(const void *s, void *d) const
+{
+    scm_reduce_16(s, d, size_t(n) * n * c);
+    return 128.0 / 65535.0;
+}
+
+// Convert a page of 32-bit floats to 16-bit floats.
+
+double scm_format::to_half(const void *s, void *d) const
+{
+    return half_page((const float *) s, (uint16 *) d, size_t(n) * n * c);
+}
+
+//------------------------------------------------------------------------------
+
+// Select the OpenGL internal texture format of the atlas. The luminance forms
+// of BC4 and BC5 are used so that shaders sample them as they would the
+// uncompressed data.
+
+GLenum scm_format::get_internal() const
+{
+    switch (form)
+    {
+    case form_bc1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case form_bc4: return GL_COMPRESSED_LUMINANCE_LATC1_EXT;
+    case form_bc5: return GL_COMPRESSED_LUMINANCE_ALPHA_LATC2_EXT;
+    case form_half:
+        switch (c)
+        {
+        case  1:   return GL_LUMINANCE16F_ARB;
+        case  2:   return GL_LUMINANCE_ALPHA16F_ARB;
+        case  3:   return GL_RGB16F_ARB;
+        default:   return GL_RGBA16F_ARB;
+        }
+    case form_byte:
+        return (c == 4) ? GL_RGBA8 : scm_internal_form(c, 8);
+    default:       return scm_internal_form(c, b);
+    }
+}
+
+// Select the OpenGL external format of uploaded pages.
+
+GLenum scm_format::get_external() const
+{
+    if (form == form_bgra)
+        return GL_BGRA;
+    else
+        return scm_external_form(c, b);
+}
+
+// Select the OpenGL data type of uploaded pages.
+
+GLenum scm_format::get_type() const
+{
+    switch (form)
+    {
+    case form_half: return GL_HALF_FLOAT_ARB;
+    case form_bgra: return GL_UNSIGNED_INT_8_8_8_8_REV;
+    case form_byte: return GL_UNSIGNED_BYTE;
+    default:        return scm_external_type(c, b);
+    }
+}
+
+// Return the size of an uploaded pixel.
+
+size_t scm_format::get_pixel_size() const
+{
+    switch (form)
+    {
+    case form_half: return size_t(c) * 2;
+    case form_bgra: return 4;
+    case form_byte: return size_t(c);
+    default:        return size_t(scm_pixel_size(c, b));
+    }
+}
+
+//------------------------------------------------------------------------------
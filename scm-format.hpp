@@ -0,0 +1,90 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_FORMAT_HPP
+#define SCM_FORMAT_HPP
+
+#include <GL/glew.h>
+#include <tiffio.h>
+
+//------------------------------------------------------------------------------
+
+/// An scm_format gives the form in which an scm_cache holds its pages.
+///
+/// Pages are loaded in the form in which they are stored in SCM TIFF files. By
+/// default they are uploaded to the atlas unchanged. Alternatively, a loader
+/// thread may convert each page to a form that is smaller or quicker to upload
+/// before handing it to the render thread. The scm_format of a cache selects
+/// this conversion, performs it, and gives the OpenGL texture formats and the
+/// pixel buffer size that follow from it.
+///
+/// Block-compressed forms require atlas slots aligned to 4x4 blocks, so the
+/// slot size of an atlas may exceed the page size plus border.
+///
+/// @see scm_cache::cache_compress
+/// @see scm_cache::cache_half
+/// @see scm_cache::cache_expand
+/// @see scm_cache::cache_reduce
+
+class scm_format
+{
+public:
+
+    scm_format(int, int, int);
+
+    bool   is_converted()  const { return (form != form_none); }
+    bool   is_compressed() const { return (form == form_bc1 ||
+                                           form == form_bc4 ||
+                                           form == form_bc5); }
+
+    int    get_slot_size()   const { return m; }
+    size_t get_page_bytes()  const;
+    size_t get_load_bytes()  const;
+
+    void   init_texture(GLenum, int, int) const;
+    void   make_texture(GLenum, int, int, int, size_t) const;
+
+    double convert(const void *, void *) const;
+
+private:
+
+    enum
+    {
+        form_none,  // As stored
+        form_bc1,   // 8-bit RGB as BC1 (DXT1)
+        form_bc4,   // 8-bit luminance as BC4 (LATC1)
+        form_bc5,   // 8-bit luminance-alpha as BC5 (LATC2)
+        form_half,  // 32-bit float as 16-bit float
+        form_bgra,  // 8-bit RGB as 8-bit BGRA
+        form_byte   // 16-bit as 8-bit
+    };
+
+    int    n;       // Page width and height with border
+    int    c;       // Channels per pixel as loaded
+    int    b;       // Bits per channel as loaded
+    int    m;       // Atlas slot width and height
+    int    form;    // Conversion
+
+    GLenum get_internal()   const;
+    GLenum get_external()   const;
+    GLenum get_type()       const;
+    size_t get_pixel_size() const;
+
+    double to_blocks(const void *, void *) const;
+    double to_half  (const void *, void *) const;
+    double to_bgra  (const void *, void *) const;
+    double to_byte  (const void *, void *) const;
+};
+
+//------------------------------------------------------------------------------
+
+#endif
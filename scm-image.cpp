@@ -34,6 +34,7 @@ scm_image::scm_image(scm_system *sys) :
     ur (-1),
     uk0(-1),
     uk1(-1),
+    cache(0),
     index(-1)
 {
 }
@@ -55,13 +56,14 @@ scm_image::~scm_image()
 /// then that SCM is released. This might trigger the destruction of an scm_file
 /// if its reference count goes to zero, and might also trigger the destruction
 /// of an scm_cache if the file count of that cache goes to zero. In the event
-/// of an scm_cache destruction, all of that cache's loader threads are asked
-/// to exit and waited upon. @see scm_system::release_scm
+/// of an scm_file destruction, the loader threads are asked to disregard that
+/// file and any loads underway are waited upon. @see scm_system::release_scm
 ///
 /// 2. The nemed SCM is aquired. If it is not already open, this will trigger
-/// the construction of a new scm_file object, and possibly the construction of
-/// an scm_cache. In the event of an scm_cache construction, loader threads for
-/// that cache are launched. @see scm_system::acquire_scm
+/// the construction of a new scm_file object by a background thread, and later
+/// possibly the construction of an scm_cache. Until then the image renders as
+/// not yet available. The new file's page requests are then serviced by the
+/// system's shared pool of loader threads. @see scm_system::acquire_scm
 ///
 /// So, while the scm_system makes every effort to minimize the effort of SCM
 /// data access, significant setup may be necessary, and it all starts here.
@@ -72,7 +74,18 @@ void scm_image::set_scm(const std::string& s)
     scm = s;
     if (!scm.empty()) index = sys->acquire_scm(scm);
 
-    cache = (index < 0) ? 0 : sys->get_cache(index);
+    cache = 0;
+}
+
+// Return the cache of this image's SCM file, if the file is open. The file may
+// be opened in the background, so the cache is sought until it is found.
+
+scm_cache *scm_image::get_cache() const
+{
+    if (cache == 0 && index >= 0)
+        cache = sys->get_cache(index);
+
+    return cache;
 }
 
 /// Set the name by which GLSL sampler uniforms may access this image.
@@ -133,6 +146,7 @@ void scm_image::init_uniforms(GLuint program)
         {
             ua[d] = glsl_uniform(program, "%s.a[%d]", name.c_str(), d);
             ub[d] = glsl_uniform(program, "%s.b[%d]", name.c_str(), d);
+            ul[d] = glsl_uniform(program, "%s.l[%d]", name.c_str(), d);
         }
     }
 }
@@ -145,15 +159,15 @@ void scm_image::bind(GLuint unit, GLuint program) const
     glUniform1f(uk0, k0);
     glUniform1f(uk1, k1);
 
-    if (cache)
+    if (get_cache())
     {
         const GLfloat r = GLfloat(cache->get_page_size())
-                        / GLfloat(cache->get_page_size() + 2)
+                        / GLfloat(cache->get_slot_size())
                         / GLfloat(cache->get_grid_size());
 
         glUniform2f(ur,  r, r);
         glActiveTexture(GL_TEXTURE0 + unit);
-        glBindTexture(GL_TEXTURE_2D, cache->get_texture());
+        glBindTexture(cache->get_target(), cache->get_texture());
     }
 }
 
@@ -162,7 +176,7 @@ void scm_image::bind(GLuint unit, GLuint program) const
 void scm_image::unbind(GLuint unit) const
 {
     glActiveTexture(GL_TEXTURE0 + unit);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(get_cache() ? cache->get_target() : GL_TEXTURE_2D, 0);
 }
 
 //------------------------------------------------------------------------------
@@ -176,11 +190,11 @@ void scm_image::unbind(GLuint unit) const
 
 void scm_image::bind_page(GLuint program, int d, int t, long long i) const
 {
-    if (cache)
+    if (get_cache())
     {
         // Get the page index and the time of its loading.
 
-        int u, l = cache->get_page(index, i, t, u);
+        int u, l = cache->get_page(index, i, t, u, 0.f);
 
         // Compute the page age.
 
@@ -193,14 +207,17 @@ void scm_image::bind_page(GLuint program, int d, int t, long long i) const
             a = std::max(a, 0.0);
         }
 
-        // Compute texture coordinate offsets and set the uniforms.
+        // Compute texture coordinate offsets and set the uniforms. The layer
+        // uniform is needed only by shaders sampling an array atlas.
 
         const int s = cache->get_grid_size();
-        const int n = cache->get_page_size();
+        const int m = cache->get_slot_size();
+        const int j = cache->get_line_slot(l);
 
         glUniform1f(ua[d], GLfloat(a));
-        glUniform2f(ub[d], GLfloat((l % s) * (n + 2) + 1) / (s * (n + 2)),
-                           GLfloat((l / s) * (n + 2) + 1) / (s * (n + 2)));
+        glUniform2f(ub[d], GLfloat((j % s) * m + 1) / (s * m),
+                           GLfloat((j / s) * m + 1) / (s * m));
+        glUniform1f(ul[d], GLfloat(cache->get_line_layer(l)));
     }
 }
 
@@ -211,16 +228,18 @@ void scm_image::unbind_page(GLuint program, int d) const
 {
     glUniform1f(ua[d], 0.f);
     glUniform2f(ub[d], 0.f, 0.f);
+    glUniform1f(ul[d], 0.f);
 }
 
-/// Set the last-used time of a page.
+/// Set the last-used time of a page, requesting it with priority k if needed.
+/// @see scm_cache::get_page
 
-void scm_image::touch_page(int t, long long i) const
+void scm_image::touch_page(int t, long long i, float k) const
 {
-    if (cache)
+    if (get_cache())
     {
         int ignored;
-        cache->get_page(index, i, t, ignored);
+        cache->get_page(index, i, t, ignored, k);
     }
 }
 
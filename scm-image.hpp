@@ -71,7 +71,7 @@ public:
 
     void   bind_page(GLuint, int, int, long long) const;
     void unbind_page(GLuint, int)                 const;
-    void  touch_page(             int, long long) const;
+    void  touch_page(             int, long long, float) const;
 
     float   get_page_sample(const double *)              const;
     void    get_page_bounds(long long, float &, float &) const;
@@ -96,9 +96,12 @@ private:
     GLint       uk1;
     GLint       ua[16];
     GLint       ub[16];
+    GLint       ul[16];
 
-    scm_cache  *cache;
-    int         index;
+    mutable scm_cache *cache;
+    int                index;
+
+    scm_cache *get_cache() const;
 };
 
 //------------------------------------------------------------------------------
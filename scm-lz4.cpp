@@ -0,0 +1,277 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+
+#include <cstring>
+
+#include <tiffio.h>
+
+#include "scm-lz4.hpp"
+
+//------------------------------------------------------------------------------
+
+// These functions implement the LZ4 block format. Each block is a sequence of
+// literal runs and back-references. A sequence begins with a token giving the
+// literal length in its high nibble and the match length minus four in its low
+// nibble, either of which is extended by following bytes if it is fifteen. The
+// literals follow, then a two-byte little-endian match offset. The final
+// sequence has literals only. The last five bytes of a block are always
+// literal, and the last match begins at least twelve bytes before the end.
+
+static const size_t lz4_min_match     =  4;
+static const size_t lz4_last_literals =  5;
+static const size_t lz4_match_limit   = 12;
+static const size_t lz4_max_offset    = 65535;
+static const int    lz4_hash_bits     = 12;
+
+// Read 32 bits from an unaligned address.
+
+static inline uint32 lz4_read(const uint8 *p)
+{
+    uint32 v;
+    memcpy(&v, p, sizeof (v));
+    return v;
+}
+
+// Hash the four bytes at the given address.
+
+static inline uint32 lz4_hash(const uint8 *p)
+{
+    return (lz4_read(p) * 2654435761U) >> (32 - lz4_hash_bits);
+}
+
+// Copy a match of k bytes at distance r to q, which has room for m bytes. The
+// match may overlap its own output. Once the first few bytes of a short
+// repeating pattern are written, a distance under eight is equivalent to a
+// multiple of itself of at least eight, so the copy may proceed eight bytes at
+// a time. Given room to spare, the last block runs past the match, into space
+// that the following sequence overwrites.
+
+static inline void lz4_copy(uint8 *q, size_t r, size_t k, size_t m)
+{
+    const uint8 *p = q - r;
+
+    size_t R = r;
+    size_t j = 0;
+
+    while (R < 8)
+        R += r;
+
+    for (; j < R - r && j < k; ++j)
+        q[j] = p[j];
+
+    if (m - k >= 8)
+        for (; j < k; j += 8)
+            memcpy(q + j, q + j - R, 8);
+    else
+    {
+        for (; j + 8 <= k; j += 8)
+            memcpy(q + j, q + j - R, 8);
+
+        for (; j < k; ++j)
+            q[j] = p[j];
+    }
+}
+
+// Write an extended length of at least fifteen, less the fifteen held by the
+// token. Return false if the output would overflow.
+
+static bool lz4_length(uint8 *dst, size_t& o, size_t m, size_t l)
+{
+    for (l -= 15; l >= 255; l -= 255)
+        if (o < m) dst[o++] = 255; else return false;
+
+    if (o < m) dst[o++] = uint8(l); else return false;
+
+    return true;
+}
+
+// Write a sequence of l literals from src followed by a match of length k at
+// offset d. A match length of zero denotes the final, literal-only sequence.
+// Return false if the output would overflow.
+
+static bool lz4_sequence(uint8 *dst, size_t& o, size_t m,
+                   const uint8 *src, size_t l, size_t d, size_t k)
+{
+    const size_t t = o++;
+
+    if (t >= m)
+        return false;
+
+    dst[t] = uint8((l < 15 ? l : 15) << 4);
+
+    if (l >= 15 && !lz4_length(dst, o, m, l))
+        return false;
+
+    if (l > m - o)
+        return false;
+
+    memcpy(dst + o, src, l);
+    o += l;
+
+    if (k)
+    {
+        k -= lz4_min_match;
+
+        if (m - o < 2)
+            return false;
+
+        dst[o++] = uint8(d & 0xFF);
+        dst[o++] = uint8(d >> 8);
+        dst[t]  |= uint8(k < 15 ? k : 15);
+
+        if (k >= 15 && !lz4_length(dst, o, m, k))
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+/// Compress a buffer using the LZ4 block format
+///
+/// Matches are found greedily using a single hash table of prior positions.
+/// This favors speed over ratio, as befits data compressed once per load.
+/// Return the compressed size, or zero if it would exceed the output buffer.
+///
+/// @param s Source buffer
+/// @param n Source buffer size in bytes
+/// @param d Destination buffer
+/// @param m Destination buffer size in bytes
+
+size_t scm_lz4_encode(const void *s, size_t n, void *d, size_t m)
+{
+    const uint8 *src = (const uint8 *) s;
+    uint8       *dst = (uint8       *) d;
+
+    size_t o = 0;
+    size_t a = 0;
+    size_t i = 0;
+
+    if (n > lz4_match_limit)
+    {
+        uint32 table[1 << lz4_hash_bits];
+
+        memset(table, 0, sizeof (table));
+
+        while (i + lz4_match_limit <= n)
+        {
+            const uint32 h = lz4_hash(src + i);
+            const size_t r = table[h];
+
+            table[h] = uint32(i);
+
+            if (r < i && i - r <= lz4_max_offset
+                      && lz4_read(src + r) == lz4_read(src + i))
+            {
+                // Extend the match as far as the final literals allow.
+
+                size_t k = lz4_min_match;
+                size_t z = n - lz4_last_literals;
+
+                while (i + k < z && src[r + k] == src[i + k])
+                    k++;
+
+                if (!lz4_sequence(dst, o, m, src + a, i - a, i - r, k))
+                    return 0;
+
+                i += k;
+                a  = i;
+            }
+            else i++;
+        }
+    }
+
+    if (!lz4_sequence(dst, o, m, src + a, n - a, 0, 0))
+        return 0;
+
+    return o;
+}
+
+/// Decompress a buffer using the LZ4 block format
+///
+/// Return false if the input is malformed or does not exactly fill the output.
+///
+/// @param s Source buffer
+/// @param n Source buffer size in bytes
+/// @param d Destination buffer
+/// @param m Destination buffer size in bytes
+
+bool scm_lz4_decode(const void *s, size_t n, void *d, size_t m)
+{
+    const uint8 *src = (const uint8 *) s;
+    uint8       *dst = (uint8       *) d;
+
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < n)
+    {
+        const uint8 t = src[i++];
+
+        size_t l = t >> 4;
+        size_t k = t & 15;
+        uint8  b;
+
+        // Copy the literals.
+
+        if (l == 15)
+            do {
+                if (i < n) l += (b = src[i++]); else return false;
+            } while (b == 255);
+
+        if (l > n - i || l > m - o)
+            return false;
+
+        // Given room to spare, copy a short run as a single block, running
+        // past it into space that the following match overwrites.
+
+        if (l <= 16 && n - i >= 16 && m - o >= 16)
+            memcpy(dst + o, src + i, 16);
+        else
+            memcpy(dst + o, src + i, l);
+
+        i += l;
+        o += l;
+
+        if (i == n)
+            break;
+
+        // Copy the match, which may overlap its own output.
+
+        if (n - i < 2)
+            return false;
+
+        const size_t r = size_t(src[i]) | (size_t(src[i + 1]) << 8);
+
+        i += 2;
+
+        if (r == 0 || r > o)
+            return false;
+
+        if (k == 15)
+            do {
+                if (i < n) k += (b = src[i++]); else return false;
+            } while (b == 255);
+
+        k += lz4_min_match;
+
+        if (k > m - o)
+            return false;
+
+        lz4_copy(dst + o, r, k, m - o);
+        o += k;
+    }
+    return (o == m);
+}
+
+//------------------------------------------------------------------------------
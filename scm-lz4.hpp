@@ -0,0 +1,27 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+
+#ifndef SCM_LZ4_HPP
+#define SCM_LZ4_HPP
+
+#include <cstddef>
+
+//------------------------------------------------------------------------------
+/// @file
+
+size_t scm_lz4_encode(const void *, size_t, void *, size_t);
+bool   scm_lz4_decode(const void *, size_t, void *, size_t);
+
+//------------------------------------------------------------------------------
+
+#endif
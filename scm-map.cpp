@@ -0,0 +1,460 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "scm-map.hpp"
+#include "scm-pixel.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Map the named TIFF file into memory
+///
+/// Confirm that the file is a TIFF or BigTIFF and note its byte order. On
+/// failure the map is left invalid and all queries upon it will fail.
+///
+/// @param path Fully resolved path and name of TIFF file
+
+scm_map::scm_map(const std::string& path) :
+    data(0), size(0), big(false), swap(false)
+{
+#ifdef WIN32
+    mapping = 0;
+    file    = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER n;
+
+        if (GetFileSizeEx(file, &n) && n.QuadPart > 8)
+        {
+            if ((mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0)))
+            {
+                if ((data = (const uint8 *) MapViewOfFile(mapping,
+                                                 FILE_MAP_READ, 0, 0, 0)))
+                    size = uint64(n.QuadPart);
+            }
+        }
+    }
+#else
+    if ((file = open(path.c_str(), O_RDONLY)) != -1)
+    {
+        struct stat info;
+
+        if (fstat(file, &info) == 0 && info.st_size > 8)
+        {
+            void *p = mmap(0, size_t(info.st_size), PROT_READ, MAP_SHARED,
+                           file, 0);
+            if (p != MAP_FAILED)
+            {
+                data = (const uint8 *) p;
+                size = uint64(info.st_size);
+            }
+        }
+    }
+#endif
+
+    // Check the byte order and version of the TIFF header.
+
+    if (data)
+    {
+        const uint16 one  = 1;
+        const bool   host = (*((const uint8 *) &one) == 1);
+
+        if      (data[0] == 'I' && data[1] == 'I') swap = !host;
+        else if (data[0] == 'M' && data[1] == 'M') swap =  host;
+        else
+        {
+            scm_log("scm_map %s is not a TIFF", path.c_str());
+            unmap();
+        }
+
+        if (data)
+        {
+            switch (get16(2))
+            {
+                case 42: big = false; break;
+                case 43: big = true;  break;
+                default: unmap();     break;
+            }
+        }
+    }
+}
+
+/// Unmap the TIFF file.
+
+scm_map::~scm_map()
+{
+    unmap();
+
+#ifdef WIN32
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+    if (file != -1) close(file);
+#endif
+}
+
+// Release the mapped view, if any, leaving the map invalid.
+
+void scm_map::unmap()
+{
+#ifdef WIN32
+    if (data) UnmapViewOfFile(data);
+#else
+    if (data) munmap((void *) data, size_t(size));
+#endif
+    data = 0;
+    size = 0;
+}
+
+//------------------------------------------------------------------------------
+
+/// Return the size in bytes of an element of the given TIFF data type.
+
+static uint64 type_size(uint16 type)
+{
+    switch (type)
+    {
+        case  1: case  2: case  6: case  7:           return 1;
+        case  3: case  8:                             return 2;
+        case  4: case  9: case 11: case 13:           return 4;
+        case  5: case 10: case 12: case 16: case 17:
+        case 18:                                      return 8;
+        default:                                      return 0;
+    }
+}
+
+/// Read a 16-bit value at file offset o, respecting the file byte order.
+
+uint16 scm_map::get16(uint64 o) const
+{
+    uint16 v;
+    memcpy(&v, data + o, sizeof (v));
+    return swap ? uint16((v >> 8) | (v << 8)) : v;
+}
+
+/// Read a 32-bit value at file offset o, respecting the file byte order.
+
+uint32 scm_map::get32(uint64 o) const
+{
+    uint32 v;
+    memcpy(&v, data + o, sizeof (v));
+    return swap ? ((v >> 24)               | ((v >>  8) & 0x0000FF00) |
+                  ((v <<  8) & 0x00FF0000) |  (v << 24)) : v;
+}
+
+/// Read a 64-bit value at file offset o, respecting the file byte order.
+
+uint64 scm_map::get64(uint64 o) const
+{
+    uint64 v;
+    memcpy(&v, data + o, sizeof (v));
+
+    if (swap)
+    {
+        uint64 u = 0;
+
+        for (int i = 0; i < 8; ++i, v >>= 8)
+            u = (u << 8) | (v & 0xFF);
+
+        return u;
+    }
+    return v;
+}
+
+/// Read element k of an integer array of the given TIFF type at file offset o.
+/// The array must lie within the file, as given by get_field.
+
+uint64 scm_map::get(uint16 type, uint64 o, uint64 k) const
+{
+    switch (type)
+    {
+        case  1: case  7:           return data[o + k];
+        case  3:                    return get16(o + k * 2);
+        case  4: case 13:           return get32(o + k * 4);
+        case 16: case 18:           return get64(o + k * 8);
+        default:                    return 0;
+    }
+}
+
+// Return the number of entries in the image file directory at file offset o,
+// or zero if the directory does not lie within the file.
+
+uint64 scm_map::get_entries(uint64 o) const
+{
+    if (data == 0 || o < 8 || o >= size - 8)
+        return 0;
+
+    const uint64 n = big ? get64(o) : get16(o);
+    const uint64 e = big ? o + 8    : o + 2;
+    const uint64 k = big ? 20       : 12;
+
+    return (n > (size - e) / k) ? 0 : n;
+}
+
+// Read entry j of the image file directory at file offset o, giving its tag,
+// type, and count, and the file offset v of its values. Values too large to
+// fit in the entry are stored out of line. Return false if they do not lie
+// within the file. The caller ensures that j is less than get_entries(o).
+
+bool scm_map::get_entry(uint64 o, uint64 j, uint16& tag, uint16& type,
+                                            uint64& count, uint64& v) const
+{
+    const uint64 e = big ? o + 8 : o + 2;
+    const uint64 k = big ? 20    : 12;
+    const uint64 m = big ?  8    :  4;
+    const uint64 q = e + j * k;
+
+    tag   = get16(q);
+    type  = get16(q + 2);
+    count = big ? get64(q + 4) : get32(q + 4);
+    v     = q + 4 + m;
+
+    if (count > size)
+        return false;
+
+    const uint64 bytes = count * type_size(type);
+
+    if (bytes > m)
+    {
+        v = big ? get64(v) : get32(v);
+
+        if (v > size || bytes > size - v)
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+/// Return the file offset of the first image file directory.
+
+uint64 scm_map::get_first() const
+{
+    if (data)
+        return big ? get64(8) : get32(4);
+    else
+        return 0;
+}
+
+/// Find a field of the image file directory at file offset o
+///
+/// Return false if the field is absent or if its values do not lie within the
+/// file.
+///
+/// @param o     Image file directory offset
+/// @param tag   TIFF tag
+/// @param type  TIFF type output
+/// @param count Value count output
+/// @param v     Value file offset output
+
+bool scm_map::get_field(uint64 o, uint16 tag, uint16& type,
+                                  uint64& count, uint64& v) const
+{
+    const uint64 n = get_entries(o);
+
+    for (uint64 j = 0; j < n; ++j)
+    {
+        uint16 t;
+
+        if (get_entry(o, j, t, type, count, v) && t == tag)
+            return true;
+    }
+    return false;
+}
+
+/// Return a pointer to an array at file offset v, as given by get_field
+///
+/// The array is referenced in place and is paged in as it is accessed. Return
+/// null if the elements of the array are not of the given size, if the array
+/// does not lie within the file or is not aligned, or if the file byte order
+/// differs from the host.
+///
+/// @param type TIFF type of the array
+/// @param v    File offset
+/// @param n    Element count
+/// @param k    Element size in bytes
+
+const void *scm_map::get_array(uint16 type, uint64 v, uint64 n, uint64 k) const
+{
+    if (data && !swap && k && type_size(type) == k && v % k == 0
+             && v <= size && n <= (size - v) / k)
+        return data + v;
+    else
+        return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/// Parse the image file directory at file offset o and find its strips
+///
+/// Confirm that the page has the expected format and that its strip arrays
+/// lie within the file. Return false if the page cannot be served from the
+/// map, in which case the caller should fall back upon libtiff.
+///
+/// @param o TIFF offset
+/// @param w Page width
+/// @param h Page height
+/// @param c Page channels per pixel
+/// @param b Page bits per channel
+/// @param s Strip layout output
+
+bool scm_map::get_strips(uint64 o, uint32 w, uint32 h,
+                                   uint16 c, uint16 b, scm_strips& s) const
+{
+    // Multi-byte samples in a foreign byte order require swapping.
+
+    if (swap && b != 8 && b != 16 && b != 32)
+        return false;
+
+    const uint64 n = get_entries(o);
+
+    uint32 W = 0, H = 0;
+    uint16 C = 1, B = 1, P = 1;
+    uint64 nb = 0;
+
+    s = scm_strips();
+    s.z = COMPRESSION_NONE;
+    s.x = (swap && b > 8) ? b / 8 : 0;
+
+    for (uint64 j = 0; j < n; ++j)
+    {
+        uint16 tag;
+        uint16 type;
+        uint64 count;
+        uint64 v;
+
+        if (!get_entry(o, j, tag, type, count, v))
+            return false;
+
+        switch (tag)
+        {
+            case TIFFTAG_IMAGEWIDTH:      W = uint32(get(type, v, 0)); break;
+            case TIFFTAG_IMAGELENGTH:     H = uint32(get(type, v, 0)); break;
+            case TIFFTAG_BITSPERSAMPLE:   B = uint16(get(type, v, 0)); break;
+            case TIFFTAG_SAMPLESPERPIXEL: C = uint16(get(type, v, 0)); break;
+            case TIFFTAG_COMPRESSION:   s.z = uint16(get(type, v, 0)); break;
+            case 284:                     P = uint16(get(type, v, 0)); break;
+
+            case TIFFTAG_STRIPOFFSETS:
+                s.o  = v;
+                s.ot = type;
+                s.n  = uint32(count);
+                break;
+
+            case TIFFTAG_STRIPBYTECOUNTS:
+                s.s  = v;
+                s.st = type;
+                nb   = count;
+                break;
+        }
+    }
+
+    // Confirm the page format and the sanity of the strip arrays.
+
+    return (W == w && H == h && C == c && B == b && (P == 1 || C == 1)
+            && s.n > 0 && s.n == nb && s.o && s.s
+            && type_size(s.ot) >= 2 && type_size(s.st) >= 2);
+}
+
+/// Copy the pixels of an uncompressed page to the given buffer
+///
+/// Return false if the page is compressed or if its strips do not exactly
+/// fill the buffer. Samples in a foreign byte order are swapped.
+///
+/// @param s Strip layout, as given by get_strips
+/// @param p Destination pixel buffer
+/// @param n Destination pixel buffer size in bytes
+
+bool scm_map::get_pixels(const scm_strips& s, void *p, size_t n) const
+{
+    if (data == 0 || s.z != COMPRESSION_NONE)
+        return false;
+
+    uint8 *dst = (uint8 *) p;
+    size_t d   = 0;
+
+    for (uint32 k = 0; k < s.n && d < n; ++k)
+    {
+        uint64 a = get(s.ot, s.o, k);
+        uint64 m = get(s.st, s.s, k);
+
+        if (a > size || m > size - a)
+            return false;
+
+        m = std::min(m, uint64(n - d));
+
+        memcpy(dst + d, data + a, size_t(m));
+        d += size_t(m);
+    }
+
+    if      (s.x == 2) scm_swap16(p, n / 2);
+    else if (s.x == 4) scm_swap32(p, n / 4);
+
+    return (d == n);
+}
+
+/// Begin reading the strips of a page in the background
+///
+/// Advise the kernel that the page's data will be needed soon. This returns
+/// immediately, so a single thread may issue read-ahead for every queued page,
+/// keeping many reads in flight on the device regardless of the number of
+/// loader threads. The loader that eventually copies or decodes the page
+/// then finds its data already resident.
+///
+/// @param s Strip layout, as given by get_strips
+
+void scm_map::prefetch(const scm_strips& s) const
+{
+#ifndef WIN32
+    if (data && s.n)
+    {
+        uint64 a = size;
+        uint64 z = 0;
+
+        for (uint32 k = 0; k < s.n; ++k)
+        {
+            uint64 o = get(s.ot, s.o, k);
+            uint64 m = get(s.st, s.s, k);
+
+            if (o < size && m <= size - o)
+            {
+                a = std::min(a, o);
+                z = std::max(z, o + m);
+            }
+        }
+
+        if (a < z)
+        {
+            const uint64 p = uint64(sysconf(_SC_PAGESIZE));
+
+            a = a - a % p;
+
+            madvise((void *) (data + a), size_t(z - a), MADV_WILLNEED);
+        }
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
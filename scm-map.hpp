@@ -0,0 +1,97 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_MAP_HPP
+#define SCM_MAP_HPP
+
+#include <string>
+
+#include <tiffio.h>
+
+#ifdef WIN32
+#include <Windows.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+/// An scm_strips structure gives the strip layout of one page of an SCM TIFF.
+///
+/// Rather than copying the strip offsets and byte counts, it records where in
+/// the file these arrays reside, along with the type of their elements.
+
+struct scm_strips
+{
+    scm_strips() : o(0), s(0), n(0), z(0), ot(0), st(0), x(0) { }
+
+    uint64 o;   ///< File offset of the strip offset array
+    uint64 s;   ///< File offset of the strip byte count array
+    uint32 n;   ///< Strip count
+    uint16 z;   ///< Compression scheme
+    uint16 ot;  ///< TIFF type of the strip offset array
+    uint16 st;  ///< TIFF type of the strip byte count array
+    uint16 x;   ///< Sample size in bytes if samples need swapping, else zero
+};
+
+//------------------------------------------------------------------------------
+
+/// An scm_map is a read-only memory mapping of an SCM TIFF file.
+///
+/// It allows the image file directory of a page to be examined and the data of
+/// an uncompressed page to be copied straight out of the file, without libtiff
+/// and without its per-page directory handling. Large arrays, such as the page
+/// catalog, may be referenced in place and paged in by the system on demand.
+
+class scm_map
+{
+public:
+
+    scm_map(const std::string&);
+   ~scm_map();
+
+    bool is_valid() const { return (data != 0); }
+
+    bool get_strips(uint64, uint32, uint32, uint16, uint16, scm_strips&) const;
+    bool get_pixels(const scm_strips&, void *, size_t)                   const;
+    void  prefetch (const scm_strips&)                                   const;
+
+    uint64      get_first()                                         const;
+    bool        get_field(uint64, uint16, uint16&, uint64&, uint64&) const;
+    const void *get_array(uint16, uint64, uint64, uint64)           const;
+    uint64      get      (uint16, uint64, uint64)                   const;
+
+private:
+
+    const uint8 *data;  ///< Mapped file data
+    uint64       size;  ///< Mapped file size
+    bool         big;   ///< Is this a BigTIFF?
+    bool         swap;  ///< Does the file byte order differ from the host?
+
+#ifdef WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int    file;
+#endif
+
+    void   unmap();
+
+    uint16 get16(uint64) const;
+    uint32 get32(uint64) const;
+    uint64 get64(uint64) const;
+
+    uint64 get_entries(uint64)                                      const;
+    bool   get_entry  (uint64, uint64, uint16&, uint16&, uint64&, uint64&) const;
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,240 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <cstring>
+
+#include <tiffio.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCM_PIXEL_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#include "scm-pixel.hpp"
+
+//------------------------------------------------------------------------------
+
+// These functions convert pixel data between the forms in which SCM files
+// store it and the forms in which the GPU most readily accepts it. Each has a
+// vectorized path for those instruction sets enabled at compile time and a
+// scalar path for any remainder. SSE2 is assumed on all x86-64 targets. SSSE3
+// is compiled in under GCC and Clang and used if the CPU supports it.
+
+/// Reverse the byte order of k 16-bit values in place.
+
+void scm_swap16(void *p, size_t k)
+{
+    uint16 *v = (uint16 *) p;
+    size_t  i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    for (; i + 8 <= k; i += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (v + i));
+        a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+        _mm_storeu_si128((__m128i *) (v + i), a);
+    }
+#endif
+    for (; i < k; ++i)
+        v[i] = uint16((v[i] >> 8) | (v[i] << 8));
+}
+
+/// Reverse the byte order of k 32-bit values in place.
+
+void scm_swap32(void *p, size_t k)
+{
+    uint32 *v = (uint32 *) p;
+    size_t  i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i m = _mm_set1_epi32(0x00FF00FF);
+
+    for (; i + 4 <= k; i += 4)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (v + i));
+
+        // Swap the bytes of each 16-bit half, then swap the halves.
+
+        a = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(a, 8), m),
+                         _mm_slli_epi32(_mm_and_si128(a, m), 8));
+        a = _mm_or_si128(_mm_srli_epi32(a, 16), _mm_slli_epi32(a, 16));
+
+        _mm_storeu_si128((__m128i *) (v + i), a);
+    }
+#endif
+    for (; i < k; ++i)
+        v[i] = (v[i] >> 24) | ((v[i] >> 8) & 0x0000FF00)
+             | (v[i] << 24) | ((v[i] << 8) & 0x00FF0000);
+}
+
+#ifdef SCM_PIXEL_SSSE3
+
+// Expand 8-bit RGB pixels to BGRA four at a time using SSSE3, returning the
+// count expanded. This function is compiled for SSSE3 regardless of the build
+// flags, and must be called only if the CPU supports it.
+
+__attribute__((target("ssse3")))
+static size_t expand_ssse3(const uint8 *p, uint8 *q, size_t k)
+{
+    size_t i = 0;
+
+    const __m128i m = _mm_setr_epi8(2,  1,  0, -1,  5,  4,  3, -1,
+                                    8,  7,  6, -1, 11, 10,  9, -1);
+    const __m128i a = _mm_set1_epi32(int(0xFF000000));
+
+    // Each pass reads sixteen bytes but uses only the first twelve, so stop
+    // while that read lies within the source.
+
+    for (; i + 6 <= k; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + 3 * i));
+        v = _mm_or_si128(_mm_shuffle_epi8(v, m), a);
+        _mm_storeu_si128((__m128i *) (q + 4 * i), v);
+    }
+    return i;
+}
+
+#endif
+
+/// Expand k 8-bit RGB pixels to opaque BGRA, as accepted by OpenGL with the
+/// GL_BGRA format and GL_UNSIGNED_INT_8_8_8_8_REV type.
+
+void scm_expand_rgb(const void *s, void *d, size_t k)
+{
+    const uint8 *p = (const uint8 *) s;
+    uint8       *q = (uint8       *) d;
+    size_t       i = 0;
+
+#ifdef SCM_PIXEL_SSSE3
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+
+    if (ssse3)
+        i = expand_ssse3(p, q, k);
+#endif
+    for (; i < k; ++i)
+    {
+        q[4 * i + 0] = p[3 * i + 2];
+        q[4 * i + 1] = p[3 * i + 1];
+        q[4 * i + 2] = p[3 * i + 0];
+        q[4 * i + 3] = 0xFF;
+    }
+}
+
+/// Reduce k 16-bit values to 8 bits, rounding to nearest.
+
+void scm_reduce_16(const void *s, void *d, size_t k)
+{
+    const uint16 *p = (const uint16 *) s;
+    uint8        *q = (uint8        *) d;
+    size_t        i = 0;
+
+    // The nearest 8-bit value to v is (x - (x >> 8)) >> 8 with x = v + 128.
+    // Saturating the sum does not change the result.
+
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i h = _mm_set1_epi16(128);
+
+    for (; i + 16 <= k; i += 16)
+    {
+        __m128i a = _mm_adds_epu16(_mm_loadu_si128((const __m128i *) (p + i    )), h);
+        __m128i b = _mm_adds_epu16(_mm_loadu_si128((const __m128i *) (p + i + 8)), h);
+
+        a = _mm_srli_epi16(_mm_sub_epi16(a, _mm_srli_epi16(a, 8)), 8);
+        b = _mm_srli_epi16(_mm_sub_epi16(b, _mm_srli_epi16(b, 8)), 8);
+
+        _mm_storeu_si128((__m128i *) (q + i), _mm_packus_epi16(a, b));
+    }
+#endif
+    for (; i < k; ++i)
+    {
+        const uint32 x = uint32(p[i]) + 128;
+        q[i] = uint8((x - (x >> 8)) >> 8);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Multiply-rotate constants of the page hash.
+
+static const uint64 hash_p1 = 0x9E3779B185EBCA87ULL;
+static const uint64 hash_p2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64 hash_p3 = 0x165667B19E3779F9ULL;
+
+static inline uint64 rotl(uint64 v, int k)
+{
+    return (v << k) | (v >> (64 - k));
+}
+
+static inline uint64 mix(uint64 h, uint64 w)
+{
+    return rotl(h + w * hash_p2, 31) * hash_p1;
+}
+
+static inline uint64 avalanche(uint64 h)
+{
+    h ^= h >> 33;
+    h *= hash_p2;
+    h ^= h >> 29;
+    h *= hash_p3;
+    h ^= h >> 32;
+    return h;
+}
+
+/// Compute a 128-bit hash of n bytes of page data.
+///
+/// Four independent lanes each consume one 64-bit word in turn, so that the
+/// multiplications of successive words overlap. The lanes are then merged in
+/// two different ways, giving two halves that each take in all 256 bits of lane
+/// state, and each half is mixed so that every input bit affects every output
+/// bit. This is not a cryptographic hash, but pages sharing an atlas line on
+/// its account would need to collide in all 128 bits.
+
+scm_digest scm_hash(const void *p, size_t n)
+{
+    const uint8 *s = (const uint8 *) p;
+    size_t       i = 0;
+    uint64       w;
+
+    uint64 a = hash_p1 + hash_p2;
+    uint64 b = hash_p2;
+    uint64 c = 0;
+    uint64 d = 0 - hash_p1;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        memcpy(&w, s + i,      8); a = mix(a, w);
+        memcpy(&w, s + i +  8, 8); b = mix(b, w);
+        memcpy(&w, s + i + 16, 8); c = mix(c, w);
+        memcpy(&w, s + i + 24, 8); d = mix(d, w);
+    }
+
+    uint64 h = rotl(a, 1) + rotl(b, 7) + rotl(c, 12) + rotl(d, 18) + n;
+    uint64 g = rotl(a, 18) ^ rotl(b, 12) ^ rotl(c, 7) ^ rotl(d, 1) ^ ~n;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        memcpy(&w, s + i, 8);
+        h = rotl(h ^ mix(0, w), 27) * hash_p1 + hash_p3;
+        g = rotl(g ^ mix(hash_p3, w), 29) * hash_p2 + hash_p1;
+    }
+    for (; i < n; ++i)
+    {
+        h = rotl(h ^ (s[i] * hash_p3), 11) * hash_p1;
+        g = rotl(g ^ (s[i] * hash_p1), 13) * hash_p2;
+    }
+    return scm_digest(avalanche(h), avalanche(g + h));
+}
+
+//------------------------------------------------------------------------------
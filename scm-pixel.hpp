@@ -0,0 +1,37 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_PIXEL_HPP
+#define SCM_PIXEL_HPP
+
+#include <cstddef>
+#include <utility>
+
+#include <tiffio.h>
+
+//------------------------------------------------------------------------------
+/// @file
+
+/// A 128-bit hash of page content, or zero if a page is not hashed.
+
+typedef std::pair<uint64, uint64> scm_digest;
+
+void scm_swap16    (void *, size_t);
+void scm_swap32    (void *, size_t);
+void scm_expand_rgb(const void *, void *, size_t);
+void scm_reduce_16 (const void *, void *, size_t);
+
+scm_digest scm_hash(const void *, size_t);
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,393 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+
+#include "scm-pool.hpp"
+#include "scm-file.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Launch a pool of loader threads and strip helper threads
+///
+/// @param n Loader thread count. If zero or less, launch one per CPU.
+/// @param m Strip helper thread count. If zero or less, launch none.
+
+scm_pool::scm_pool(int n, int m) : run(true), next(0)
+{
+    mutex = SDL_CreateMutex();
+    needs = SDL_CreateSemaphore(0);
+    jobs  = SDL_CreateSemaphore(0);
+    reads = SDL_CreateSemaphore(0);
+
+    if (n <= 0)
+        n = SDL_GetCPUCount();
+
+    // Launch the loader, helper, and reader threads.
+
+    int loader(void *);
+    int helper(void *);
+    int reader(void *);
+
+    for (int i = 0; i < n; ++i)
+        threads.push_back(SDL_CreateThread(loader, "scm-loader", this));
+    for (int i = 0; i < m; ++i)
+        helpers.push_back(SDL_CreateThread(helper, "scm-helper", this));
+
+    prefetcher = SDL_CreateThread(reader, "scm-reader", this);
+
+    scm_log("scm_pool constructor %d %d", n, m);
+}
+
+/// Command all loader threads to exit and await their exit.
+
+scm_pool::~scm_pool()
+{
+    scm_log("scm_pool destructor");
+
+    SDL_LockMutex(mutex);
+    run = false;
+    SDL_UnlockMutex(mutex);
+
+    // A post per thread ensures that each loader unblocks.
+
+    for (size_t i = 0; i < threads.size(); ++i)
+        SDL_SemPost(needs);
+
+    for (size_t i = 0; i < threads.size(); ++i)
+        SDL_WaitThread(threads[i], 0);
+
+    SDL_SemPost(reads);
+    SDL_WaitThread(prefetcher, 0);
+
+    // With the loaders gone no strip jobs remain, and each helper unblocks
+    // to find an empty queue.
+
+    for (size_t i = 0; i < helpers.size(); ++i)
+        SDL_SemPost(jobs);
+
+    for (size_t i = 0; i < helpers.size(); ++i)
+        SDL_WaitThread(helpers[i], 0);
+
+    SDL_DestroySemaphore(reads);
+    SDL_DestroySemaphore(jobs);
+    SDL_DestroySemaphore(needs);
+    SDL_DestroyMutex(mutex);
+}
+
+//------------------------------------------------------------------------------
+
+/// Begin servicing the needs queue of the given file.
+
+void scm_pool::add_file(scm_file *file)
+{
+    SDL_LockMutex(mutex);
+    {
+        files.push_back(file);
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+/// Cease servicing the needs queue of the given file and discard its pending
+/// read-ahead. Tasks already underway run to completion. @see is_busy
+
+void scm_pool::del_file(scm_file *file)
+{
+    SDL_LockMutex(mutex);
+    {
+        files.erase(std::remove(files.begin(), files.end(), file), files.end());
+        next = 0;
+
+        for (scm_fifo<read_job>::iterator i = ahead.begin(); i != ahead.end();)
+            if (i->file == file)
+                i = ahead.erase(i);
+            else
+                ++i;
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+/// Return true if any loader, or the reader, is working on the given file.
+
+bool scm_pool::is_busy(scm_file *file)
+{
+    bool b;
+
+    SDL_LockMutex(mutex);
+    {
+        b = (busy.find(file) != busy.end());
+    }
+    SDL_UnlockMutex(mutex);
+
+    return b;
+}
+
+/// Notify the pool that a task has been added to a needs queue.
+
+void scm_pool::add_need()
+{
+    SDL_SemPost(needs);
+}
+
+/// Queue read-ahead of a page of the given file. This is called by the render
+/// thread as the page's task is queued, and returns immediately.
+///
+/// @param file File containing the page
+/// @param j    Page catalog index
+/// @param o    TIFF offset
+
+void scm_pool::add_read(scm_file *file, uint64 j, uint64 o)
+{
+    read_job job;
+
+    job.file = file;
+    job.j    = j;
+    job.o    = o;
+
+    SDL_LockMutex(mutex);
+    {
+        ahead.enq(job);
+    }
+    SDL_UnlockMutex(mutex);
+
+    SDL_SemPost(reads);
+}
+
+/// Decode the strips of a page in parallel
+///
+/// The strips are divided into contiguous spans, one per helper plus one for
+/// the calling loader, which decodes the first span using its own handle while
+/// the helpers decode the rest. A helper finding no libtiff handle to spare
+/// leaves its span undone, and the loader decodes it afterward. Return false
+/// if any strip fails to decode.
+///
+/// @param file File containing the page
+/// @param T    libtiff handle positioned at the page
+/// @param o    TIFF offset
+/// @param N    Strip count
+/// @param S    Strip size in bytes
+/// @param p    Destination pixel buffer
+
+bool scm_pool::decode(scm_file *file, TIFF *T, uint64 o,
+                      tsize_t N, tsize_t S, void *p)
+{
+    const tsize_t k = std::min(tsize_t(helpers.size() + 1), N);
+
+    std::vector<strip_job> v((size_t) k);
+
+    SDL_sem *done = SDL_CreateSemaphore(0);
+
+    for (tsize_t i = 0; i < k; ++i)
+    {
+        v[i].file = file;
+        v[i].o    = o;
+        v[i].a    = N * (i    ) / k;
+        v[i].z    = N * (i + 1) / k;
+        v[i].S    = S;
+        v[i].p    = p;
+        v[i].ok   = false;
+        v[i].done = done;
+    }
+
+    // Queue all but the first span for the helpers.
+
+    SDL_LockMutex(mutex);
+    {
+        for (tsize_t i = 1; i < k; ++i)
+            queue.enq(&v[i]);
+    }
+    SDL_UnlockMutex(mutex);
+
+    for (tsize_t i = 1; i < k; ++i)
+        SDL_SemPost(jobs);
+
+    // Decode the first span here and await the rest.
+
+    bool r = file->read_strips(T, o, v[0].a, v[0].z, S, p);
+
+    for (tsize_t i = 1; i < k; ++i)
+        SDL_SemWait(done);
+
+    for (tsize_t i = 1; i < k; ++i)
+        if (r && !v[i].ok)
+            r = file->read_strips(T, o, v[i].a, v[i].z, S, p);
+
+    SDL_DestroySemaphore(done);
+    return r;
+}
+
+//------------------------------------------------------------------------------
+
+// Take a task from the needs queue of the next file in round-robin order and
+// note that the file is busy. Return false if the pool is shutting down or if
+// no task is found, as when the file of a queued task has been removed.
+
+bool scm_pool::get_need(scm_file *& file, scm_task& task)
+{
+    bool b = false;
+
+    SDL_LockMutex(mutex);
+    {
+        const size_t n = files.size();
+
+        for (size_t k = 0; run && !b && k < n; ++k)
+        {
+            const size_t j = (next + k) % n;
+
+            if (files[j]->get_need(task))
+            {
+                file = files[j];
+                next = (j + 1) % n;
+                busy[file]++;
+                b = true;
+            }
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    return b;
+}
+
+// Note that a task of the given file is complete.
+
+void scm_pool::end_need(scm_file *file)
+{
+    SDL_LockMutex(mutex);
+    {
+        if (--busy[file] == 0)
+            busy.erase(file);
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+//------------------------------------------------------------------------------
+
+/// Service page load requests
+///
+/// This function is the entry point for loader threads. The void data pointer
+/// gives the scm_pool. Each pass awaits notification of a queued task, takes
+/// a task from whichever file is next, and loads it.
+
+int loader(void *data)
+{
+    scm_pool *pool = (scm_pool *) data;
+    scm_file *file;
+    scm_task  task;
+
+    scm_log("loader thread begin");
+
+    while (SDL_SemWait(pool->needs) == 0)
+    {
+        SDL_LockMutex(pool->mutex);
+        bool run = pool->run;
+        SDL_UnlockMutex(pool->mutex);
+
+        if (!run)
+            break;
+
+        if (pool->get_need(file, task))
+        {
+            file->serve(task);
+            pool->end_need(file);
+        }
+    }
+
+    scm_log("loader thread end");
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/// Decode strips on behalf of a loader
+///
+/// This function is the entry point for strip helper threads. The void data
+/// pointer gives the scm_pool. Each pass awaits a queued strip job, decodes its
+/// span of strips, and signals its completion.
+
+int helper(void *data)
+{
+    scm_pool  *pool = (scm_pool *) data;
+    strip_job *job;
+
+    scm_log("helper thread begin");
+
+    while (SDL_SemWait(pool->jobs) == 0)
+    {
+        job = 0;
+
+        SDL_LockMutex(pool->mutex);
+        {
+            if (!pool->queue.empty())
+                job = pool->queue.deq();
+        }
+        SDL_UnlockMutex(pool->mutex);
+
+        if (!job)
+            break;
+
+        job->ok = job->file->read_strips(0, job->o, job->a, job->z,
+                                                 job->S, job->p);
+        SDL_SemPost(job->done);
+    }
+
+    scm_log("helper thread end");
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/// Read ahead on behalf of the loaders
+///
+/// This function is the entry point for the reader thread. The void data
+/// pointer gives the scm_pool. Each pass awaits a queued read-ahead job and
+/// begins reading its page. A job may have been discarded by the removal of
+/// its file, in which case the pass finds an empty queue and waits again.
+
+int reader(void *data)
+{
+    scm_pool *pool = (scm_pool *) data;
+    read_job  job;
+
+    scm_log("reader thread begin");
+
+    while (SDL_SemWait(pool->reads) == 0)
+    {
+        bool run;
+        bool got = false;
+
+        SDL_LockMutex(pool->mutex);
+        {
+            if ((run = pool->run) && !pool->ahead.empty())
+            {
+                job = pool->ahead.deq();
+                pool->busy[job.file]++;
+                got = true;
+            }
+        }
+        SDL_UnlockMutex(pool->mutex);
+
+        if (!run)
+            break;
+
+        if (got)
+        {
+            job.file->prefetch(job.j, job.o);
+            pool->end_need(job.file);
+        }
+    }
+
+    scm_log("reader thread end");
+    return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,125 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_POOL_HPP
+#define SCM_POOL_HPP
+
+#include <vector>
+#include <map>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include "scm-task.hpp"
+#include "scm-fifo.hpp"
+
+//------------------------------------------------------------------------------
+
+class scm_file;
+
+/// @cond INTERNAL
+
+/// A strip_job gives a span of the strips of one page, to be decoded by a
+/// helper thread into its own slice of the destination buffer.
+
+struct strip_job
+{
+    scm_file *file;
+    uint64    o;        // TIFF offset
+    tsize_t   a;        // First strip
+    tsize_t   z;        // Last strip plus one
+    tsize_t   S;        // Strip size in bytes
+    void     *p;        // Destination pixel buffer
+    bool      ok;       // Success flag
+    SDL_sem  *done;     // Completion signal
+};
+
+/// A read_job names a queued page whose data is to be read ahead.
+
+struct read_job
+{
+    scm_file *file;
+    uint64    j;        // Page catalog index
+    uint64    o;        // TIFF offset
+};
+
+/// @endcond
+
+//------------------------------------------------------------------------------
+
+/// An scm_pool is the set of loader threads shared by all open SCM files.
+///
+/// Each scm_file retains its own needs queue. Whenever a task is added to any
+/// of these queues the pool is notified, and an idle loader takes the task of
+/// whichever file is next in round-robin order. Thus a single busy file may
+/// occupy every loader while many files share the loaders fairly, and the
+/// thread count does not grow with the number of open files.
+///
+/// The pool may also include helper threads, among which the strips of a single
+/// compressed page are divided, reducing the latency of each page.
+///
+/// A single reader thread issues read-ahead for each queued page of a mapped
+/// file, parsing the page's directory if necessary. This keeps many reads in
+/// flight on the device regardless of the loader count, without the render
+/// thread touching the file.
+///
+/// @see scm_file
+/// @see scm_cache::cache_threads
+/// @see scm_cache::strip_threads
+
+class scm_pool
+{
+public:
+
+    scm_pool(int, int);
+   ~scm_pool();
+
+    void add_file(scm_file *);
+    void del_file(scm_file *);
+    bool is_busy (scm_file *);
+
+    void add_need();
+    void add_read(scm_file *, uint64, uint64);
+
+    int  get_helper_count() const { return int(helpers.size()); }
+    bool decode(scm_file *, TIFF *, uint64, tsize_t, tsize_t, void *);
+
+private:
+
+    bool get_need(scm_file *&, scm_task&);
+    void end_need(scm_file *);
+
+    SDL_mutex                *mutex;
+    SDL_sem                  *needs;    // Count of queued tasks
+    bool                      run;      // Should the loaders continue?
+    size_t                    next;     // Round-robin file cursor
+
+    std::vector<scm_file *>   files;    // Files currently served
+    std::map<scm_file *, int> busy;     // Tasks in progress, per file
+    std::vector<SDL_Thread *> threads;
+
+    SDL_sem                  *jobs;     // Count of queued strip jobs
+    scm_fifo<strip_job *>     queue;    // Strip jobs awaiting a helper
+    std::vector<SDL_Thread *> helpers;
+
+    SDL_sem                  *reads;    // Count of queued read-aheads
+    scm_fifo<read_job>        ahead;    // Pages awaiting read-ahead
+    SDL_Thread               *prefetcher;
+
+    friend int loader(void *);
+    friend int helper(void *);
+    friend int reader(void *);
+};
+
+//------------------------------------------------------------------------------
+
+#endif
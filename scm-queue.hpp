@@ -14,9 +14,11 @@
 #define SCM_QUEUE_HPP
 
 #include <SDL.h>
+#include <SDL_atomic.h>
 #include <SDL_thread.h>
 
-#include <set>
+#include <algorithm>
+#include <vector>
 
 //------------------------------------------------------------------------------
 
@@ -30,6 +32,11 @@
 /// blocking operations while the render thread uses non-blocking operations to
 /// ensure that frames are not dropped due to data latency.
 ///
+/// The queue is a binary heap in storage allocated once at construction, so
+/// no operation allocates. The heap is guarded by a spin lock held only for a
+/// logarithmic number of copies, and the semaphores are touched only to count
+/// slots, which does not enter the kernel unless a thread must block.
+///
 /// @see scm_file
 /// @see scm_cache
 
@@ -48,47 +55,79 @@ public:
 
 private:
 
-    SDL_sem   *full_slots;
-    SDL_sem   *free_slots;
-    SDL_mutex *data_mutex;
+    SDL_sem     *full_slots;
+    SDL_sem     *free_slots;
+    SDL_SpinLock data_lock;
+
+    // Order the heap such that the least element is at its root.
+
+    struct later
+    {
+        bool operator()(const T& a, const T& b) const { return b < a; }
+    };
+
+    void push(const T&);
+    void pop (T&);
 
-    std::set<T> S;
+    std::vector<T> H;
+    size_t         c;
 };
 
 //------------------------------------------------------------------------------
 
 /// Create a new queue with n slots. Initialize counting semaphores for full
-/// slots and empty slots, plus a mutex to protect the data.
+/// slots and empty slots, plus a spin lock to protect the data.
 
-template <typename T> scm_queue<T>::scm_queue(int n)
+template <typename T> scm_queue<T>::scm_queue(int n) : data_lock(0), H(n), c(0)
 {
     full_slots = SDL_CreateSemaphore(0);
     free_slots = SDL_CreateSemaphore(n);
-    data_mutex = SDL_CreateMutex();
 }
 
-/// Finalize a queue and release its mutex and semaphores.
+/// Finalize a queue and release its semaphores.
 
 template <typename T> scm_queue<T>::~scm_queue()
 {
-    SDL_DestroyMutex    (data_mutex);
     SDL_DestroySemaphore(free_slots);
     SDL_DestroySemaphore(full_slots);
 }
 
 //------------------------------------------------------------------------------
 
+// Add an element to the heap. The caller holds a free slot, so room remains.
+
+template <typename T> void scm_queue<T>::push(const T& d)
+{
+    SDL_AtomicLock(&data_lock);
+    {
+        H[c++] = d;
+        std::push_heap(H.begin(), H.begin() + c, later());
+    }
+    SDL_AtomicUnlock(&data_lock);
+}
+
+// Remove the least element from the heap. The caller holds a full slot, so an
+// element remains.
+
+template <typename T> void scm_queue<T>::pop(T& d)
+{
+    SDL_AtomicLock(&data_lock);
+    {
+        std::pop_heap(H.begin(), H.begin() + c, later());
+        d = H[--c];
+    }
+    SDL_AtomicUnlock(&data_lock);
+}
+
+//------------------------------------------------------------------------------
+
 /// Non-blocking enqueue for use by the render thread.
 
 template <typename T> bool scm_queue<T>::try_insert(T& d)
 {
     if (SDL_SemTryWait(free_slots) == 0)
     {
-        SDL_LockMutex(data_mutex);
-        {
-            S.insert(d);
-        }
-        SDL_UnlockMutex(data_mutex);
+        push(d);
         SDL_SemPost(full_slots);
         return true;
     }
@@ -101,12 +140,7 @@ template <typename T> bool scm_queue<T>::try_remove(T& d)
 {
     if (SDL_SemTryWait(full_slots) == 0)
     {
-        SDL_LockMutex(data_mutex);
-        {
-            d   = *(S.begin());
-            S.erase(S.begin());
-        }
-        SDL_UnlockMutex(data_mutex);
+        pop(d);
         SDL_SemPost(free_slots);
         return true;
     }
@@ -120,11 +154,7 @@ template <typename T> bool scm_queue<T>::try_remove(T& d)
 template <typename T> void scm_queue<T>::insert(T d)
 {
     SDL_SemWait(free_slots);
-    SDL_LockMutex(data_mutex);
-    {
-        S.insert(d);
-    }
-    SDL_UnlockMutex(data_mutex);
+    push(d);
     SDL_SemPost(full_slots);
 }
 
@@ -135,12 +165,7 @@ template <typename T> T scm_queue<T>::remove()
     T d;
 
     SDL_SemWait(full_slots);
-    SDL_LockMutex(data_mutex);
-    {
-        d   = *(S.begin());
-        S.erase(S.begin());
-    }
-    SDL_UnlockMutex(data_mutex);
+    pop(d);
     SDL_SemPost(free_slots);
 
     return d;
@@ -270,15 +270,15 @@ void scm_scene::unbind_page(int channel, int depth) const
 
 /// Touch a page in each image matching a channel. @see scm_image::touch_page
 
-void scm_scene::touch_page(int channel, int frame, long long i) const
+void scm_scene::touch_page(int channel, int frame, long long i, float k) const
 {
 #if 0
     for (int j = 0; j < get_image_count(); ++j)
         if (images[j]->is_channel(channel))
-            images[j]->touch_page(frame, i);
+            images[j]->touch_page(frame, i, k);
 #else
     for (int j = 0; j < get_image_count(); ++j)
-        images[j]->touch_page(frame, i);
+        images[j]->touch_page(frame, i, k);
 #endif
 }
 
@@ -108,7 +108,7 @@ public:
 
     void   bind_page(int, int, int, long long) const;
     void unbind_page(int, int)                 const;
-    void  touch_page(int,      int, long long) const;
+    void  touch_page(int,      int, long long, float) const;
 
     float   get_minimum_ground()               const;
     float   get_current_ground(const double *) const;
@@ -19,36 +19,111 @@
 
 //------------------------------------------------------------------------------
 
+/// Create an empty page set.
+
+scm_set::scm_set() : table(16, -1), count(0), head(-1), tail(-1), idle(-1)
+{
+}
+
 /// Search for the given page in this page set. If found, update the page entry
 /// with the current time t to indicate recent use.
 
 scm_page scm_set::search(scm_page page, int t)
 {
-    std::map<scm_page, int>::iterator i = m.find(page);
+    const int j = lookup(page);
 
-    if (i != m.end())
+    if (j >= 0)
     {
-        scm_page p = i->first;
-
-        remove(p);
-        insert(p, t);
-        return(p);
+        nodes[j].t = t;
+        unlink(j);
+        link(j);
+        return nodes[j].page;
     }
     return scm_page();
 }
 
-/// Add a page to this set, associated with the current time.
+/// Add a page to this set, associated with the current time. If the page is
+/// already present, only its time is updated.
 
 void scm_set::insert(scm_page page, int t)
 {
-    m[page] = t;
+    size_t k = find(page);
+    int    j = table[k];
+
+    if (j >= 0)
+    {
+        nodes[j].t = t;
+        unlink(j);
+        link(j);
+        return;
+    }
+
+    if ((count + 1) * 2 > table.size())
+    {
+        grow();
+        k = find(page);
+    }
+
+    if (idle >= 0)
+    {
+        j    = idle;
+        idle = nodes[j].next;
+    }
+    else
+    {
+        j = int(nodes.size());
+        nodes.push_back(node());
+    }
+
+    nodes[j].page = page;
+    nodes[j].t    = t;
+    nodes[j].kids = 0;
+    link(j);
+
+    table[k] = j;
+    order.insert(page);
+    count++;
+
+    // Count this page's children and note it among its parent's.
+
+    for (int c = 0; c < 4; ++c)
+        if (lookup(scm_item(page.f, scm_page_child(page.i, c))) >= 0)
+            nodes[j].kids++;
+
+    if (page.i > 5)
+    {
+        const int p = lookup(scm_item(page.f, scm_page_parent(page.i)));
+
+        if (p >= 0)
+            nodes[p].kids++;
+    }
 }
 
 /// Remove a page from this set.
 
 void scm_set::remove(scm_page page)
 {
-    m.erase(page);
+    const size_t k = find(page);
+    const int    j = table[k];
+
+    if (j >= 0)
+    {
+        if (page.i > 5)
+        {
+            const int p = lookup(scm_item(page.f, scm_page_parent(page.i)));
+
+            if (p >= 0)
+                nodes[p].kids--;
+        }
+
+        unlink(j);
+        order.erase(nodes[j].page);
+        erase(k);
+
+        nodes[j].next = idle;
+        idle = j;
+        count--;
+    }
 }
 
 /// Eject a page from this set to accommodate the addition of a new page.
@@ -56,63 +131,187 @@ void scm_set::remove(scm_page page)
 /// The general polity is LRU, but with considerations for time and priority
 /// that help mitigate thrashing.
 ///
-/// @param t Current time
-/// @param i Page index
+/// If the tree flag is set then the quadtree is respected. Only pages with no
+/// children in the set are ejected, so that a parent remains to stand in for
+/// any missing child, and the root pages are never ejected, so that some page
+/// always covers every part of the sphere.
+///
+/// @param t    Current time
+/// @param i    Page index
+/// @param tree Respect the page hierarchy?
 
-scm_page scm_set::eject(int t, long long i)
+scm_page scm_set::eject(int t, long long i, bool tree)
 {
-    assert(!m.empty());
-
-    // Determine the lowest priority and least-recently used pages.
-
-    std::map<scm_page, int>::iterator a = m.end();
-    std::map<scm_page, int>::iterator l = m.end();
-    std::map<scm_page, int>::iterator e;
-
-    for (e = m.begin(); e != m.end(); ++e)
-    {
-        if (a == m.end() || e->second < a->second) a = e;
-                                                   l = e;
-    }
+    assert(count);
 
     // If the LRU page was not used in this scene or the last, eject it.
     // Otherwise consider the lowest-priority loaded page and eject if it
-    // has lower priority than the incoming page.
+    // has lower priority than the incoming page. The lowest-priority page
+    // is the deepest, and thus has no children in the set.
 
-    if (a != m.end() && a->second < t - 2)
+    for (int j = tail; j >= 0 && nodes[j].t < t - 2; j = nodes[j].prev)
     {
-        scm_page page = a->first;
-        m.erase(a);
-        return page;
+        if (!tree || (nodes[j].kids == 0 && nodes[j].page.i > 5))
+        {
+            scm_page page = nodes[j].page;
+            remove(page);
+            return page;
+        }
     }
-    if (l != m.end() && i < l->first.i)
+    if (!order.empty() && i < order.rbegin()->i)
     {
-        scm_page page = l->first;
-        m.erase(l);
-        return page;
+        if (!tree || order.rbegin()->i > 5)
+        {
+            scm_page page = nodes[lookup(*order.rbegin())].page;
+            remove(page);
+            return page;
+        }
     }
     return scm_page();
 }
 
+/// Append to v every page last used before time t.
+
+void scm_set::older(int t, std::vector<scm_page>& v) const
+{
+    for (int j = tail; j >= 0 && nodes[j].t < t; j = nodes[j].prev)
+        v.push_back(nodes[j].page);
+}
+
+/// Append to v every page occupying cache line l or higher.
+
+void scm_set::above(int l, std::vector<scm_page>& v) const
+{
+    for (int j = head; j >= 0; j = nodes[j].next)
+        if (nodes[j].page.l >= l)
+            v.push_back(nodes[j].page);
+}
+
 /// Return true if the set is empty.
 
 bool scm_set::empty() const
 {
-    return m.empty();
+    return (count == 0);
 }
 
-/// Dump the contents of the set to stdout.
+/// Return the number of pages in the set.
 
-void scm_set::dump() const
+size_t scm_set::size() const
 {
-    std::map<scm_page, int>::const_iterator i;
+    return count;
+}
+
+/// Dump the contents of the set to stdout, most recently used first.
 
-    printf("%lu : ", m.size());
+void scm_set::dump() const
+{
+    printf("%lu : ", (unsigned long) count);
 
-    for (i = m.begin(); i != m.end(); ++i)
-        printf("%d/%lld ", i->first.f, i->first.i);
+    for (int j = head; j >= 0; j = nodes[j].next)
+        printf("%d/%lld ", nodes[j].page.f, nodes[j].page.i);
 
     printf("\n");
 }
 
 //------------------------------------------------------------------------------
+
+// Return the node of the given page, or -1 if the page is not in the set.
+
+int scm_set::lookup(const scm_item& p) const
+{
+    return table[find(p)];
+}
+
+// Compute the hash of a page reference.
+
+size_t scm_set::hash(const scm_item& p) const
+{
+    unsigned long long h = (unsigned long long) p.i * 0x9E3779B97F4A7C15ULL
+                         ^ (unsigned long long) p.f * 0xC2B2AE3D27D4EB4FULL;
+
+    return size_t(h ^ (h >> 29));
+}
+
+// Return the hash table slot of the given page, or the empty slot at which it
+// would be inserted.
+
+size_t scm_set::find(const scm_item& p) const
+{
+    const size_t m = table.size() - 1;
+
+    size_t k = hash(p) & m;
+
+    while (table[k] >= 0)
+    {
+        const scm_page& q = nodes[table[k]].page;
+
+        if (q.i == p.i && q.f == p.f)
+            break;
+
+        k = (k + 1) & m;
+    }
+    return k;
+}
+
+// Double the size of the hash table.
+
+void scm_set::grow()
+{
+    table.assign(table.size() * 2, -1);
+
+    for (int j = head; j >= 0; j = nodes[j].next)
+        table[find(nodes[j].page)] = j;
+}
+
+// Clear hash table slot k. Shift back any following entries that would no
+// longer be found across the gap.
+
+void scm_set::erase(size_t k)
+{
+    const size_t m = table.size() - 1;
+
+    table[k] = -1;
+
+    for (size_t j = (k + 1) & m; table[j] >= 0; j = (j + 1) & m)
+    {
+        const size_t h = hash(nodes[table[j]].page) & m;
+
+        // Move the entry at j into the gap at k unless its home slot h lies
+        // cyclically within (k, j].
+
+        if ((k < j) ? (h <= k || j < h) : (h <= k && j < h))
+        {
+            table[k] = table[j];
+            table[j] = -1;
+            k = j;
+        }
+    }
+}
+
+// Insert node j at the front of the recency list.
+
+void scm_set::link(int j)
+{
+    nodes[j].prev = -1;
+    nodes[j].next = head;
+
+    if (head >= 0)
+        nodes[head].prev = j;
+    else
+        tail = j;
+
+    head = j;
+}
+
+// Remove node j from the recency list.
+
+void scm_set::unlink(int j)
+{
+    const int p = nodes[j].prev;
+    const int n = nodes[j].next;
+
+    if (p >= 0) nodes[p].next = n; else head = n;
+    if (n >= 0) nodes[n].prev = p; else tail = p;
+}
+
+//------------------------------------------------------------------------------
@@ -13,7 +13,9 @@
 #ifndef SCM_SET_HPP
 #define SCM_SET_HPP
 
-#include <map>
+#include <cstddef>
+#include <vector>
+#include <set>
 
 #include "scm-item.hpp"
 
@@ -37,23 +39,65 @@ struct scm_page : public scm_item
 
 /// An scm_set represents an a set of active pages, either currently in
 /// a cache or awaiting loading, with associated insertion time.
+///
+/// Pages are found through a hash table and kept in a list ordered by recency
+/// of use, so that a search, which moves a page to the front of the list, takes
+/// constant time, as does finding the least-recently used page. Pages are also
+/// kept in priority order, so that finding the lowest-priority page takes
+/// constant time and its removal logarithmic time. Times are assumed to be
+/// non-decreasing.
+///
+/// Each page notes how many of its children are also present, allowing the
+/// ejection of pages whose children remain to be avoided.
 
 class scm_set
 {
 public:
 
+    scm_set();
+
     scm_page search(scm_page, int);
     void     insert(scm_page, int);
     void     remove(scm_page);
 
-    scm_page eject(int, long long);
+    scm_page eject(int, long long, bool);
+    void     older(int, std::vector<scm_page>&) const;
+    void     above(int, std::vector<scm_page>&) const;
 
-    bool empty() const;
-    void dump()  const;
+    bool   empty() const;
+    size_t size()  const;
+    void   dump()  const;
 
 private:
 
-    std::map<scm_page, int> m;
+    /// @cond INTERNAL
+
+    struct node
+    {
+        scm_page page;  // Page
+        int      t;     // Time of last use
+        int      prev;  // More recently used node, or -1
+        int      next;  // Less recently used node, or -1
+        int      kids;  // Number of this page's children in the set
+    };
+
+    /// @endcond
+
+    std::vector<node> nodes;    // Node pool
+    std::vector<int>  table;    // Hash table of node indices, or -1
+    std::set<scm_item> order;   // Pages in priority order
+    size_t            count;    // Number of pages in the set
+    int               head;     // Most recently used node, or -1
+    int               tail;     // Least recently used node, or -1
+    int               idle;     // First unused node, or -1
+
+    int    lookup(const scm_item&) const;
+    size_t hash  (const scm_item&) const;
+    size_t find  (const scm_item&) const;
+    void   grow  ();
+    void   erase (size_t);
+    void   link  (int);
+    void   unlink(int);
 };
 
 //------------------------------------------------------------------------------
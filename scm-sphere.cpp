@@ -138,12 +138,13 @@ void scm_sphere::draw(scm_scene *scene, const double *M,
 
     prep(scene, M, width, height, channel, scene->uzoomk >= 0);
 
-    // Pre-cache all visible pages in breadth-first order.
+    // Pre-cache all visible pages in breadth-first order, giving the on-screen
+    // size of each so that the most visible pages are loaded first.
 
-    std::set<long long>::iterator i;
+    std::map<long long, float>::iterator i;
 
     for (i = pages.begin(); i != pages.end(); ++i)
-        scene->touch_page(channel, frame, (*i));
+        scene->touch_page(channel, frame, i->first, i->second);
 
     // Bind the vertex buffer.
 
@@ -432,7 +433,7 @@ void scm_sphere::add_page(const double *M,
 
         if (k > 0)
         {
-            pages.insert(i);
+            pages[i] = float(k);
 
             if (i > 5)
             {
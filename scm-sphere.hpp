@@ -15,7 +15,7 @@
 
 #include <GL/glew.h>
 #include <vector>
-#include <set>
+#include <map>
 
 #include "scm-scene.hpp"
 
@@ -59,7 +59,7 @@ private:
 
     // Data structures and algorithms for handling face adaptive subdivision.
 
-    std::set<long long> pages;
+    std::map<long long, float> pages;   // Visible pages and their pixel sizes
 
     bool     is_set (long long i) const { return (pages.find(i) != pages.end()); }
     void    set_page(long long i);
@@ -0,0 +1,229 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+
+#include <cstdlib>
+#include <cstring>
+
+#include "scm-store.hpp"
+#include "scm-lz4.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Create an empty page store
+///
+/// @param limit    Maximum size of all stored page data in bytes
+/// @param compress Compress stored pages?
+
+scm_store::scm_store(size_t limit, bool compress) :
+    size(0), limit(limit), compress(compress),
+    hits(0), misses(0), raw(0), packed(0)
+{
+    mutex = SDL_CreateMutex();
+
+    scm_log("scm_store constructor %lu %d", (unsigned long) limit, compress);
+}
+
+/// Report the effectiveness of the store and release all stored pages.
+
+scm_store::~scm_store()
+{
+    scm_log("scm_store destructor %llu hits %llu misses", hits, misses);
+
+    if (compress && packed)
+        scm_log("scm_store compression ratio %.2f", double(raw) / packed);
+
+    std::map<scm_item, entry>::iterator i;
+
+    for (i = pages.begin(); i != pages.end(); ++i)
+        free(i->second.p);
+
+    SDL_DestroyMutex(mutex);
+}
+
+//------------------------------------------------------------------------------
+
+/// Copy the data of a stored page to the given buffer
+///
+/// Decompress the page if necessary. LZ4 decompression reads back its own
+/// output, and the destination may be a write-only pixel buffer mapping, so
+/// decompress to a temporary buffer and copy that. Return false if the page is
+/// not stored, was stored with a different size, or fails to decompress.
+///
+/// The page data is marked as being read while the lock is held, and is then
+/// decompressed or copied without it. Should the page be ejected meanwhile,
+/// its data is released by the last reader.
+///
+/// @param item Page reference
+/// @param p    Destination buffer
+/// @param n    Destination buffer size in bytes
+
+bool scm_store::get(const scm_item& item, void *p, size_t n)
+{
+    void  *d = 0;
+    size_t z = 0;
+    bool   b = false;
+
+    SDL_LockMutex(mutex);
+    {
+        std::map<scm_item, entry>::iterator i = pages.find(item);
+
+        if (i != pages.end() && i->second.n == n)
+        {
+            order.splice(order.begin(), order, i->second.j);
+
+            d = i->second.p;
+            z = i->second.z;
+
+            readers[d]++;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    if (d)
+    {
+        if (z < n)
+        {
+            if (void *q = malloc(n))
+            {
+                if ((b = scm_lz4_decode(d, z, q, n)))
+                    memcpy(p, q, n);
+                free(q);
+            }
+        }
+        else
+        {
+            memcpy(p, d, n);
+            b = true;
+        }
+    }
+
+    bool last = false;
+
+    SDL_LockMutex(mutex);
+    {
+        if (d && --readers[d] == 0)
+        {
+            readers.erase(d);
+            last = (orphans.erase(d) > 0);
+        }
+        if (b) hits++; else misses++;
+    }
+    SDL_UnlockMutex(mutex);
+
+    if (last) free(d);
+
+    return b;
+}
+
+/// Add a page to the store, taking ownership of its data
+///
+/// If compression is enabled and reduces the size of the page then store the
+/// compressed data instead. Eject least-recently-used pages as needed to remain
+/// within the budget. A page larger than the entire budget is simply released.
+///
+/// @param item Page reference
+/// @param p    Page data, allocated using malloc
+/// @param n    Page data size in bytes
+
+void scm_store::put(const scm_item& item, void *p, size_t n)
+{
+    size_t z = n;
+
+    // Compress the page, keeping the result only if it is smaller.
+
+    if (compress && n > 1)
+    {
+        if (void *q = malloc(n))
+        {
+            if ((z = scm_lz4_encode(p, n, q, n - 1)))
+            {
+                void *r = realloc(q, z);
+                free(p);
+                p = r ? r : q;
+            }
+            else
+            {
+                free(q);
+                z = n;
+            }
+        }
+    }
+
+    if (z > limit)
+    {
+        free(p);
+        return;
+    }
+
+    std::vector<void *> dead;
+
+    SDL_LockMutex(mutex);
+    {
+        std::map<scm_item, entry>::iterator i = pages.find(item);
+
+        // Replace any existing copy of this page.
+
+        if (i != pages.end())
+        {
+            size -= i->second.z;
+            drop(i->second.p, dead);
+            order.erase(i->second.j);
+            pages.erase(i);
+        }
+
+        // Eject pages until the new page fits.
+
+        while (size + z > limit && !order.empty())
+        {
+            i = pages.find(order.back());
+
+            size -= i->second.z;
+            drop(i->second.p, dead);
+            pages.erase(i);
+            order.pop_back();
+        }
+
+        // Insert the new page as most recently used.
+
+        entry e;
+
+        e.p = p;
+        e.n = n;
+        e.z = z;
+        e.j = order.insert(order.begin(), item);
+
+        pages[item] = e;
+        size   += z;
+        raw    += n;
+        packed += z;
+    }
+    SDL_UnlockMutex(mutex);
+
+    for (size_t k = 0; k < dead.size(); ++k)
+        free(dead[k]);
+}
+
+// Dispose of the data of an ejected page. If a get is reading it, leave it to
+// be released by the last reader. Otherwise add it to the list of data to be
+// released once the lock is dropped. The caller holds the lock.
+
+void scm_store::drop(void *p, std::vector<void *>& dead)
+{
+    if (readers.find(p) != readers.end())
+        orphans.insert(p);
+    else
+        dead.push_back(p);
+}
+
+//------------------------------------------------------------------------------
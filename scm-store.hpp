@@ -0,0 +1,89 @@
+// Copyright (C) 2011-2016 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+
+#ifndef SCM_STORE_HPP
+#define SCM_STORE_HPP
+
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include "scm-item.hpp"
+
+//------------------------------------------------------------------------------
+
+/// An scm_store is a host-memory cache of decoded page data.
+///
+/// It sits between the loader threads and the scm_cache. When a page ejected
+/// from a cache atlas is needed again, a loader finds it here and copies it to
+/// the pixel buffer, rather than reading and decoding it anew. Pages are keyed
+/// by scm_item and ejected in least-recently-used order to keep the total size
+/// of the store within its budget. All operations are thread-safe, and the lock
+/// is held only to update the map and usage order. Page data is compressed,
+/// decompressed, and copied without it.
+///
+/// Pages may optionally be held compressed using the LZ4 block format, which
+/// allows more pages to be kept within the same budget at the cost of a fast
+/// decompression upon each hit.
+///
+/// @see scm_cache::store_size
+/// @see scm_cache::store_compress
+
+class scm_store
+{
+public:
+
+    scm_store(size_t, bool);
+   ~scm_store();
+
+    bool get(const scm_item&, void *, size_t);
+    void put(const scm_item&, void *, size_t);
+
+private:
+
+    /// @cond INTERNAL
+
+    struct entry
+    {
+        void  *p;                           // Page data
+        size_t n;                           // Page data size in bytes
+        size_t z;                           // Stored data size in bytes
+        std::list<scm_item>::iterator j;    // Position in the usage order
+    };
+
+    /// @endcond
+
+    void drop(void *, std::vector<void *>&);
+
+    SDL_mutex                 *mutex;
+    size_t                     size;        // Current size in bytes
+    size_t                     limit;       // Maximum size in bytes
+    bool                       compress;    // Compress stored pages?
+    std::map<scm_item, entry>  pages;       // Stored pages
+    std::list<scm_item>        order;       // Pages, most recently used first
+    std::map<void *, int>      readers;     // Gets in progress, per page data
+    std::set<void *>           orphans;     // Ejected page data still being read
+
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long raw;                 // Total size of pages stored
+    unsigned long long packed;              // Total size of data stored
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -32,15 +32,19 @@
 #include "scm-sphere.hpp"
 #include "scm-render.hpp"
 #include "scm-system.hpp"
+#include "scm-pool.hpp"
+#include "scm-store.hpp"
 #include "scm-log.hpp"
 
 //------------------------------------------------------------------------------
 
-/// Create a new empty SCM system. Instantiate a render handler and a sphere
-/// handler.
+/// Create a new empty SCM system. Instantiate a render handler, a sphere
+/// handler, a pool of loader threads, and a store of decoded pages if needed.
 ///
 /// @see scm_render::scm_render
 /// @see scm_sphere::scm_sphere
+/// @see scm_pool::scm_pool
+/// @see scm_store::scm_store
 ///
 /// @param w  Width of the off-screen render target (in pixels)
 /// @param h  Height of the off-screen render target (in pixels)
@@ -48,7 +52,7 @@
 /// @param l  Limit at which sphere pages are subdivided (in pixels)
 
 scm_system::scm_system(int w, int h, int d, int l) :
-    serial(1), frame(0), sync(false)
+    store(0), serial(1), frame(0), sync(false)
 {
     TIFFSetWarningHandler(0);
     TIFFSetErrorHandler  (0);
@@ -59,15 +63,33 @@ scm_system::scm_system(int w, int h, int d, int l) :
     render = new scm_render(w, h);
     sphere = new scm_sphere(d, l);
     path   = new scm_path();
+    pool   = new scm_pool(scm_cache::cache_threads,
+                          scm_cache::strip_threads);
+
+    if (scm_cache::store_size > 0)
+        store = new scm_store(size_t(scm_cache::store_size) << 20,
+                              scm_cache::store_compress != 0);
 }
 
 /// Finalize all SCM system state.
 
 scm_system::~scm_system()
 {
+    // Await any files still being opened, and discard them.
+
+    for (active_open_v::iterator i = opens.begin(); i != opens.end(); ++i)
+    {
+        SDL_WaitThread((*i)->thread, 0);
+        delete (*i)->file;
+        delete (*i);
+    }
+    opens.clear();
+
     while (get_scene_count())
         del_scene(0);
 
+    delete pool;
+    delete store;
     delete path;
     delete sphere;
     delete render;
@@ -174,6 +196,8 @@ int scm_system::get_scene_count() const
 
 void scm_system::update_cache()
 {
+    check_open();
+
     for (active_cache_i i = caches.begin(); i != caches.end(); ++i)
         i->second.cache->update(frame, sync);
     frame++;
@@ -248,60 +272,149 @@ void scm_system::pop_path()
 
 //------------------------------------------------------------------------------
 
+/// Open an SCM file in the background. This is the entry point of a thread
+/// launched by begin_open. The void data pointer gives the active_open.
+
+int opener(void *data)
+{
+    active_open *o = (active_open *) data;
+
+    std::string pathname = o->path.search(o->name);
+
+    if (!pathname.empty())
+        o->file = new scm_file(o->name, pathname);
+
+    SDL_AtomicSet(&o->done, 1);
+    return 0;
+}
+
 /// Internal: Load the named SCM file, if not already loaded.
 ///
-/// Add a new scm_file object to the collection and return its index. If needed,
-/// create a new scm_cache object to manage this file's data. This will always
-/// succeed as an scm_file object produces fallback data under error conditions,
-/// such as an unfound SCM TIFF.
+/// Add a new scm_file object to the collection and return its index. The file
+/// is searched for and opened by a background thread, so this returns at once.
+/// Until the open completes the index gives no pages, and is thus rendered as
+/// not yet available. In synchronous mode, await the open. @see check_open
+///
+/// If an earlier open failed to find the file, search for it again under the
+/// same index, so that its existing users see it if it has since appeared.
 
 int scm_system::acquire_scm(const std::string& name)
 {
     scm_log("acquire_scm %s", name.c_str());
 
-    // If the file is loaded, note another usage.
+    // If the file is known, note another usage. Otherwise give it an index.
 
-    if (files[name].file)
+    if (files[name].uses)
         files[name].uses++;
     else
     {
-        // Otherwise load the file.
+        files[name].index = serial++;
+        files[name].uses  = 1;
+    }
+
+    // Begin loading the file if it is neither loaded nor loading.
+
+    if (files[name].file == 0 && !files[name].opening)
+        begin_open(name, files[name].index);
+
+    return files[name].index;
+}
+
+/// Internal: Begin opening the named SCM file under the given index. Launch a
+/// background thread to search for and open it, or open it at once if no
+/// thread can be launched or if in synchronous mode.
+
+void scm_system::begin_open(const std::string& name, int index)
+{
+    active_open *o = new active_open(name, *path, index);
+
+    files[name].opening = true;
+
+    int opener(void *);
+
+    if ((o->thread = SDL_CreateThread(opener, "scm-opener", o)) == 0)
+        opener(o);
+
+    if (o->thread == 0 || sync)
+    {
+        if (o->thread)
+            SDL_WaitThread(o->thread, 0);
+        end_open(o);
+    }
+    else opens.push_back(o);
+}
+
+/// Internal: Complete the opening of an SCM file.
+///
+/// If the file is still wanted then make it available. If needed, create a
+/// new scm_cache object to manage this file's data. Otherwise, as when the
+/// file was released while opening, discard it. If no such file was found,
+/// its entry remains, marked as not opening, and the next acquire_scm of the
+/// name searches again. The active_open is deleted.
+
+void scm_system::end_open(active_open *o)
+{
+    active_file_i i = files.find(o->name);
+
+    if (i != files.end() && i->second.index == o->index)
+    {
+        i->second.opening = false;
+
+        if (o->file == 0)
+            scm_log("* end_open could not find %s", o->name.c_str());
+    }
+
+    if (o->file && i != files.end() && i->second.index == o->index)
+    {
+        scm_file *file = o->file;
+
+        i->second.file = file;
+
+        // Make sure we have a compatible cache.
 
-        std::string pathname = path->search(name);
+        cache_param cp(file);
 
-        if (!pathname.empty())
+        if (caches[cp].cache)
+            caches[cp].uses++;
+        else
         {
-            if (scm_file *file = new scm_file(name, pathname))
-            {
-                int index = serial++;
+            caches[cp].cache = new scm_cache(this, cp.n, cp.c, cp.b);
+            caches[cp].uses  = 1;
+        }
 
-                files[name].file  = file;
-                files[name].index = index;
-                files[name].uses  = 1;
+        // Associate the index, file, and cache in the reverse look-up.
 
-                // Make sure we have a compatible cache.
+        SDL_mutexP(mutex);
+        pairs[o->index] = active_pair(file, caches[cp].cache);
+        SDL_mutexV(mutex);
 
-                cache_param cp(file);
+        file->activate(caches[cp].cache, pool, store);
+    }
+    else delete o->file;
 
-                if (caches[cp].cache)
-                    caches[cp].uses++;
-                else
-                {
-                    caches[cp].cache = new scm_cache(this, cp.n, cp.c, cp.b);
-                    caches[cp].uses  = 1;
-                }
+    delete o;
+}
+
+/// Internal: Complete the opening of all SCM files whose background threads
+/// have finished. This is called by the render thread each frame.
+
+void scm_system::check_open()
+{
+    active_open_v::iterator i = opens.begin();
 
-                // Associate the index, file, and cache in the reverse look-up.
+    while (i != opens.end())
+    {
+        if (SDL_AtomicGet(&(*i)->done))
+        {
+            active_open *o = (*i);
 
-                SDL_mutexP(mutex);
-                pairs[index] = active_pair(files[name].file, caches[cp].cache);
-                SDL_mutexV(mutex);
+            i = opens.erase(i);
 
-                file->activate(caches[cp].cache);
-            }
+            SDL_WaitThread(o->thread, 0);
+            end_open(o);
         }
+        else ++i;
     }
-    return files[name].index;
 }
 
 /// Release the named SCM file.
@@ -314,23 +427,40 @@ int scm_system::release_scm(const std::string& name)
 {
     scm_log("release_scm %s", name.c_str());
 
+    if (files.find(name) == files.end())
+        return -1;
+
     // Release the named file and delete it if no uses remain.
 
     if (--files[name].uses == 0)
     {
+        // If the file is still opening, or was not found, simply forget it.
+
+        if (files[name].file == 0)
+        {
+            files.erase(name);
+            return -1;
+        }
+
         // Remove the index from the reverse look-up.
 
         SDL_mutexP(mutex);
         pairs.erase(files[name].index);
         SDL_mutexV(mutex);
 
-        // Signal the loaders to prepare to exit.
+        // Signal the loaders to disregard this file.
 
         files[name].file->deactivate();
 
-        // Cycle the cache to ensure the loaders unblock.
+        // Cycle the cache until the loaders are done with this file.
 
         cache_param cp(files[name].file);
+
+        while (pool->is_busy(files[name].file))
+        {
+            caches[cp].cache->update(0, true);
+            SDL_Delay(1);
+        }
         caches[cp].cache->update(0, true);
 
         // Delete the file.
@@ -17,6 +17,7 @@
 #include <set>
 
 #include <SDL.h>
+#include <SDL_atomic.h>
 #include <SDL_thread.h>
 
 #include "scm-file.hpp"
@@ -88,6 +89,8 @@ class scm_scene;
 class scm_cache;
 class scm_sphere;
 class scm_render;
+class scm_pool;
+class scm_store;
 
 typedef std::vector<scm_scene *>           scm_scene_v;
 typedef std::vector<scm_scene *>::iterator scm_scene_i;
@@ -113,14 +116,38 @@ typedef std::map<int, active_pair> active_pair_m;
 
 struct active_file
 {
-    active_file() : file(0), uses(0), index(-1) { }
+    active_file() : file(0), uses(0), index(-1), opening(false) { }
 
     scm_file  *file;
     int        uses;
     int        index;
+    bool       opening;
 };
 
-typedef std::map<std::string, active_file> active_file_m;
+typedef std::map<std::string, active_file>           active_file_m;
+typedef std::map<std::string, active_file>::iterator active_file_i;
+
+/// An active_open structure represents an scm_file being opened by a background
+/// thread. The thread searches a private copy of the path list, so that the
+/// render thread may continue to modify its own.
+
+struct active_open
+{
+    active_open(const std::string& name, const scm_path& path, int index)
+        : name(name), path(path), file(0), index(index), thread(0)
+    {
+        SDL_AtomicSet(&done, 0);
+    }
+
+    std::string  name;
+    scm_path     path;
+    scm_file    *file;
+    int          index;
+    SDL_Thread  *thread;
+    SDL_atomic_t done;
+};
+
+typedef std::vector<active_open *> active_open_v;
 
 /// An active_cache structure represents a reference-counted scm_cache object.
 
@@ -239,14 +266,21 @@ private:
     scm_render    *render;
     scm_sphere    *sphere;
     scm_path      *path;
+    scm_pool      *pool;
+    scm_store     *store;
 
     active_file_m  files;
     active_cache_m caches;
     active_pair_m  pairs;
+    active_open_v  opens;
 
     int            serial;
     int            frame;
     bool           sync;
+
+    void begin_open(const std::string&, int);
+    void   end_open(active_open *);
+    void check_open();
 };
 
 //------------------------------------------------------------------------------
@@ -16,11 +16,12 @@
 
 #include "scm-task.hpp"
 #include "scm-file.hpp"
+#include "scm-cache.hpp"
 
 //------------------------------------------------------------------------------
 
 scm_task::scm_task()
-    : scm_item()
+    : scm_item(), k(0), h(0, 0)
 {
 }
 
@@ -30,11 +31,12 @@ scm_task::scm_task()
 /// @param i Page index
 
 scm_task::scm_task(int f, long long i)
-    : scm_item(f, i), o(0), n(0), c(0), b(0), u(0), d(false)
+    : scm_item(f, i), o(0), n(0), c(0), b(0), k(0), h(0, 0), u(0), d(false)
 {
 }
 
-/// Construct a load task. Map the PBO to provide a destination for the loader.
+/// Construct a load task. Map the PBO to provide a destination for the loader,
+/// or if the cache has a persistently-mapped ring, take the address of a slot.
 ///
 /// @param f File index
 /// @param i Page index
@@ -42,36 +44,46 @@ scm_task::scm_task(int f, long long i)
 /// @param n Page size in pixels
 /// @param c Page channels per pixel
 /// @param b Page bits per channel
-/// @param u Pixel buffer object
+/// @param k Page on-screen size in pixels, giving its priority
+/// @param u Pixel buffer object, or ring slot
 /// @param C Destination cache
 
-scm_task::scm_task(int f, long long i, uint64 o, int n, int c, int b, GLuint u, scm_cache *C)
-    : scm_item(f, i), o(o), n(n), c(c), b(b), u(u), d(false), C(C)
+scm_task::scm_task(int f, long long i, uint64 o, int n, int c, int b, float k, GLuint u, scm_cache *C)
+    : scm_item(f, i), o(o), n(n), c(c), b(b), k(k), h(0, 0), u(u), d(false), C(C)
 {
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
+    if (C->is_persistent())
+        p = C->get_ring_data(u);
+    else
     {
-        const size_t s = size_t(n + 2) * size_t(n + 2) * scm_pixel_size(c, b);
-        glBufferData(GL_PIXEL_UNPACK_BUFFER, s, 0, GL_STREAM_DRAW);
-        p = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
+        {
+            const size_t s = C->get_format().get_page_bytes();
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, s, 0, GL_STREAM_DRAW);
+            p = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     }
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
 /// Upload the pixel buffer to the OpenGL texture object.
 ///
 /// @param x Location of upper-left pixel
 /// @param y Location of upper-left pixel
+/// @param z Layer of an array atlas
 
-void scm_task::make_page(int x, int y)
+void scm_task::make_page(int x, int y, int z)
 {
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
+    if (C->is_persistent())
+        C->put_ring_data(u, x, y, z);
+    else
     {
-        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, n + 2, n + 2,
-                                     scm_external_form(c, b),
-                                     scm_external_type(c, b), 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
+        {
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            C->get_format().make_texture(C->get_target(), x, y, z, 0);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     }
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
 /// Discard the pixel buffer
@@ -79,18 +91,22 @@ void scm_task::make_page(int x, int y)
 /// This used when a load task was created but its data should not be uploaded
 /// to VRAM. This may be because the task could not be added to the load queue,
 /// because the loader thread failed, or because the page was rejected for cache
-/// inertion due priority.
+/// inertion due priority. A ring slot stays mapped and needs no release.
 
 void scm_task::dump_page()
 {
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
+    if (!C->is_persistent())
     {
-        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
+        {
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     }
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
-/// Load a page. On success, mark the buffer as dirty.
+/// Load a page and mark the buffer as dirty. On failure the buffer shows an
+/// error message, and false is returned.
 ///
 /// This method is called by a loader thread and exists solely to marshal
 /// the entensive argument list of the global function scm_load_page.
@@ -100,7 +116,8 @@ void scm_task::dump_page()
 
 bool scm_task::load_page(const char *name, TIFF *T)
 {
-    return (d = scm_load_page(name, i, T, o, n + 2, n + 2, c, b, p));
+    d = true;
+    return scm_load_page(name, i, T, o, n + 2, n + 2, c, b, p);
 }
 
 //------------------------------------------------------------------------------
@@ -17,6 +17,7 @@
 #include <tiffio.h>
 
 #include "scm-item.hpp"
+#include "scm-pixel.hpp"
 
 //------------------------------------------------------------------------------
 
@@ -35,9 +36,9 @@ struct scm_task : public scm_item
 {
     scm_task();
     scm_task(int, long long);
-    scm_task(int, long long, uint64, int, int, int, GLuint, scm_cache *);
+    scm_task(int, long long, uint64, int, int, int, float, GLuint, scm_cache *);
 
-    void make_page(int, int);
+    void make_page(int, int, int);
     bool load_page(const char *, TIFF *);
     void dump_page();
 
@@ -45,10 +46,21 @@ struct scm_task : public scm_item
     int        n;          ///< Page size
     int        c;          ///< Page channel per pixel
     int        b;          ///< Page bits per channel
-    GLuint     u;          ///< Pixel unpack buffer object
+    float      k;          ///< Page on-screen size in pixels
+    scm_digest h;          ///< Page content hash, or zero if not hashed
+    GLuint     u;          ///< Pixel unpack buffer object or ring slot
     bool       d;          ///< Pixel unpack buffer dirty flag
     void      *p;          ///< Pixel unpack buffer map address
     scm_cache *C;          ///< Destination cache
+
+    /// Order tasks such that the largest pages on screen come first, falling
+    /// back upon the coarse-to-fine order of scm_item.
+
+    bool operator<(const scm_task& that) const {
+        if (k > that.k) return true;
+        if (k < that.k) return false;
+        return scm_item::operator<(that);
+    }
 };
 
 //------------------------------------------------------------------------------